@@ -103,7 +103,7 @@ void send_req(net_connect_t *c, void *arg)
 
         net_buf_append(req, "Host: libnet\r\n");
         net_buf_append(req, "\r\n");
-        list_append(&c->outbuf, &req->node);
+        net_connection_append(c, req);
     }
 
     // send client req
@@ -8,18 +8,81 @@
 
 #include "list.h"
 #include "net.h"
+#include "tpool.h"
 #include "util.h"
 
+net_tpool_t *pool;
+
+typedef struct {
+    char *name;
+    char reply[128];
+} hello_job_t;
+
+
+// pool thread: lua state is created per job, nothing is shared.
+void hello_lua_work(void *arg)
+{
+    const char *res = "[lua error]";
+    hello_job_t *job = arg;
+
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+    luaL_dostring(L, "hello = require \"hello\"");
+    lua_getglobal(L, "hello");
+    lua_getfield(L, -1, "append");
+    lua_pushstring(L, job->name);
+    int code = lua_pcall(L, 1, 1, 0);
+    if (code == 0)
+    {
+        res = lua_tostring(L, -1);
+        loginfo("success: append lua suffix.\n");
+    }
+    else {
+        logerr("aborted: %s\n", lua_tostring(L, -1));
+    }
+
+    snprintf(job->reply, sizeof(job->reply), "== hello %s ==\n", res);
+    lua_close(L);
+}
+
+
+// back on the loop, @c is NULL if it's gone meanwhile.
+void hello_lua_done(net_connect_t *c, void *arg)
+{
+    hello_job_t *job = arg;
+
+    if (c)
+    {
+        // encode
+        net_buf_t *buf = net_buf_alloc(c->loop, strlen(job->reply));
+        net_buf_copy(buf, job->reply, strlen(job->reply));
+        net_connection_append(c, buf);
+        net_connection_send(c);
+
+        // next request may already be buffered.
+        c->data = NULL;
+        net_connection_resume(c);
+        net_connection_process(c);
+    }
+
+    free(job->name);
+    free(job);
+}
+
+
 // user-defined OnMessage callback.
 // steps: decode -> process -> encode
 int net_request_process(char *start, size_t size, net_connect_t *c)
 {
-    const char *res = "[lua error]";
     char *tail = NULL;
     int parsed_bytes = -1;
+    hello_job_t *job;
 
     if (size <= 0) return NET_AGAIN;
 
+    // one request in the pool at a time, replies keep their order.
+    if (c->data) return 0;
+
     // decode
     if ((tail = strstr(start, "\n")))
     {
@@ -28,28 +91,18 @@ int net_request_process(char *start, size_t size, net_connect_t *c)
         loginfo("recv data: '%s'\n", start);
         parsed_bytes = tail - start + 1;
 
-        // lua logic
-        lua_State *L = luaL_newstate();
-        luaL_openlibs(L);
-        luaL_dostring(L, "hello = require \"hello\"");
-        lua_getglobal(L, "hello");
-        lua_getfield(L, -1, "append");
-        lua_pushstring(L, start);
-        int code = lua_pcall(L, 1, 1, 0);
-        if (code == 0)
+        // lua logic is slow, keep it off the loop.
+        job = calloc(1, sizeof(hello_job_t));
+        job->name = strdup(start);
+        if (net_tpool_submit(pool, c, hello_lua_work, hello_lua_done, job))
         {
-            res = lua_tostring(L, -1);
-            loginfo("success: append lua suffix.\n");
-        }
-        else {
-            logerr("aborted: %s\n", lua_tostring(L, -1));
+            free(job->name);
+            free(job);
+            return NET_ERR;
         }
 
-        // encode
-        net_buf_t *buf = net_buf_create(100);
-        buf->pos += snprintf(buf->buf, buf->size, "== hello %s ==\n", res);
-        list_append(&c->outbuf, &buf->node);
-        net_connection_send(c);
+        c->data = job;
+        net_connection_suspend(c);
 
         // return parsed bytes
         return parsed_bytes;
@@ -92,6 +145,13 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    pool = net_tpool_init(0);
+    if (!pool)
+    {
+        logerr("init thread pool failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
     net_server_set_message_callback(server, net_request_process);
 
     net_loop_start(loop);
@@ -24,9 +24,9 @@ int net_request_process(char *start, size_t size, net_connect_t *c)
         parsed_bytes = tail - start + 1;
 
         // encode
-        net_buf_t *buf = net_buf_create(parsed_bytes + sizeof("== hello x =="));
+        net_buf_t *buf = net_buf_alloc(c->loop, parsed_bytes + sizeof("== hello x =="));
         buf->pos += snprintf(buf->buf, buf->size, "== hello %s ==\n", start);
-        list_append(&c->outbuf, &buf->node);
+        net_connection_append(c, buf);
         net_connection_send(c);
 
         // return parsed bytes
@@ -54,6 +54,7 @@ void summary(net_loop_t *loop, void *arg)
 {
     req_stats *stats = arg;
     struct timeval diff;
+    unsigned long hits, misses;
 
     timeval_subtract(&diff, &stats->stop_time, &stats->start_time);
     float ms = diff.tv_usec / 1000.0;
@@ -63,6 +64,9 @@ void summary(net_loop_t *loop, void *arg)
     loginfo("req_cnt: %d\n", stats->req_cnt);
     loginfo("res_cnt: %d\n", stats->res_cnt);
     loginfo("time elapsed: %lds %.3fms\n", diff.tv_sec, ms);
+
+    net_loop_buf_stats(loop, &hits, &misses);
+    loginfo("buf pool hits: %lu, misses: %lu\n", hits, misses);
 }
 
 
@@ -81,7 +85,7 @@ void send_req(net_connect_t *c, void *arg)
         net_buf_t *req = net_buf_create(0);
         net_buf_append(req, "GET /foo HTTP/1.1\r\n");
         net_buf_append(req, "\r\n");
-        list_append(&c->outbuf, &req->node);
+        net_connection_append(c, req);
     }
 
     // send client req
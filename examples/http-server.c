@@ -1,7 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "http.h"
+#include "static.h"
 #include "util.h"
 
 
@@ -17,7 +19,7 @@ void http_request_foo(http_request_t *req, http_response_t *res)
     http_res_add_header(res, "Content-Type", "application/json");
 
     // http body
-    buf = net_buf_create(0);
+    buf = net_buf_alloc(res->conn->loop, 0);
 
     net_buf_append(buf, "{");
     LIST_FOR_EACH(&req->headers, iter)
@@ -41,7 +43,7 @@ void http_request_bar(http_request_t *req, http_response_t *res)
     http_res_add_header(res, "Content-Type", "application/json");
 
     // http body
-    buf = net_buf_create(0);
+    buf = net_buf_alloc(res->conn->loop, 0);
 
     net_buf_append(buf, "{");
     net_buf_append(buf, "\"bar\": \"foo\"");
@@ -59,7 +61,7 @@ void http_request_def(http_request_t *req, http_response_t *res)
     http_res_add_header(res, "Content-Type", "application/json");
 
     // http body
-    buf = net_buf_create(0);
+    buf = net_buf_alloc(res->conn->loop, 0);
 
     net_buf_append(buf, "{");
     net_buf_append(buf, "\"bar\": \"foo\"");
@@ -69,27 +71,148 @@ void http_request_def(http_request_t *req, http_response_t *res)
 }
 
 
+void http_request_user(http_request_t *req, http_response_t *res)
+{
+    net_buf_t *buf;
+
+    http_res_add_header(res, "Content-Type", "application/json");
+
+    // http body - parameter of the matched route
+    buf = net_buf_alloc(res->conn->loop, 0);
+    net_buf_append(buf, "{\"id\": \"%s\"}", http_req_param(req, "id"));
+
+    http_res_set_body(res, buf);
+}
+
+
+void http_request_echo(http_request_t *req, http_response_t *res)
+{
+    net_buf_t *buf;
+
+    http_res_add_header(res, "Content-Type", "application/octet-stream");
+
+    // http body - the request body, buffered
+    buf = net_buf_alloc(res->conn->loop, req->body_size + 1);
+    if (req->body_size) net_buf_copy(buf, req->body, req->body_size);
+
+    http_res_set_body(res, buf);
+}
+
+
+// request body is counted as it arrives, nothing is buffered.
+int http_upload_body(http_request_t *req, char *data, int len)
+{
+    return NET_OK;
+}
+
+
+void http_request_upload(http_request_t *req, http_response_t *res)
+{
+    net_buf_t *buf;
+
+    http_res_add_header(res, "Content-Type", "application/json");
+
+    buf = net_buf_alloc(res->conn->loop, 0);
+    net_buf_append(buf, "{\"size\": %ld}", req->body_size);
+
+    http_res_set_body(res, buf);
+}
+
+
+// bytes of /stream/:size still to be written.
+void http_stream_more(http_response_t *res, void *arg)
+{
+    long *left = arg;
+    char block[16 * 1024];
+    int n;
+
+    if (res->aborted)
+    {
+        free(left);
+        return;
+    }
+
+    memset(block, 'x', sizeof(block));
+
+    while (*left > 0)
+    {
+        n = *left < sizeof(block) ? *left : sizeof(block);
+        *left -= n;
+
+        // goes on from here once the client caught up.
+        if (http_res_write(res, block, n) != NET_OK) return;
+    }
+
+    free(left);
+    http_res_end(res);
+}
+
+
+void http_request_stream(http_request_t *req, http_response_t *res)
+{
+    long *left = malloc(sizeof(long));
+
+    if (left == NULL)
+    {
+        http_res_set_status(res, 500, "Internal Server Error");
+        return;
+    }
+    *left = atol(http_req_param(req, "size"));
+
+    // http body - generated as it's sent, chunked
+    http_res_add_header(res, "Content-Type", "text/plain");
+    http_res_set_write_callback(res, http_stream_more, left);
+    http_stream_more(res, left);
+}
+
+
 int main(int argc, char *argv[])
 {
     http_server_t *httpd;
     char *host, *port;
+    int workers;
+
+    // drop idle keep-alive, slow header and stalled clients
+    net_timeouts_t timeouts = {
+        .idle = 60 * 1000,
+        .read = 10 * 1000,
+        .write = 30 * 1000,
+    };
 
     if (argc < 3)
     {
-        printf("usage: %s host port\n", argv[0]);
+        printf("usage: %s host port [workers] [epoll|uring] [static root]\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
 
     host = argv[1];
     port = argv[2];
+    workers = argc > 3 ? atoi(argv[3]) : 1;
 
     net_log_level(LOG_INFO);
 
-    httpd = http_server_init(host, atoi(port));
+    if (argc > 4 && strcmp(argv[4], "uring") == 0)
+        net_loop_engine(NET_ENGINE_URING);
+
+    httpd = http_server_init(host, atoi(port), workers);
+    http_server_set_timeouts(httpd, &timeouts);
 
     http_add_route(httpd, "/foo", http_request_foo);
     http_add_route(httpd, "/bar", http_request_bar);
     http_add_route(httpd, "/def", http_request_def);
+    http_add_route_method(httpd, HTTP_GET, "/users/:id", http_request_user, NULL);
+    http_add_route_method(httpd, HTTP_POST, "/echo", http_request_echo, NULL);
+    http_add_body_route(httpd, HTTP_POST, "/upload", http_upload_body,
+            http_request_upload, NULL);
+    http_add_route_method(httpd, HTTP_GET, "/stream/:size", http_request_stream,
+            NULL);
+
+    // files below [static root] are served as /static/...
+    if (argc > 5 && !http_add_static(httpd, "/static/", argv[5]))
+    {
+        exit(EXIT_FAILURE);
+    }
 
     http_server_start(httpd);
 }
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "http.h"
+#include "util.h"
+
+/*
+ * Wire level checks of the http server: every case sends raw bytes on a
+ * fresh connection and compares all that comes back until the server
+ * closes it, a server still waiting for input fails the case. Bytes in
+ * @more follow @req after a pause, once the server is done reading it.
+ */
+
+#define TEST_PORT    8897
+#define TEST_TIMEOUT 2
+#define TEST_PAUSE   50
+
+typedef struct {
+    const char *name;
+    const char *req;
+    const char *res;
+    const char *more;
+} http_test_t;
+
+http_test_t http_tests[] = {
+    {
+        "get",
+        "GET /hello HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nConnection: close\r\nServer: libnet/0.0.1\r\n\r\n"
+        "hello",
+    },
+    {
+        "bare LF ending the request line",
+        "GET /hello HTTP/1.1\nHost: x\n\n",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "bare LF ending a header",
+        "GET /hello HTTP/1.1\r\nHost: x\n\r\n",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "bare LF in a header value",
+        "GET /hello HTTP/1.1\r\nHost: x\nX-Evil: y\r\n\r\n",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "bare LF in the url",
+        "GET /he\nllo HTTP/1.1\r\nHost: x\r\n\r\n",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "head then get",
+        "HEAD /hello HTTP/1.1\r\nHost: x\r\n\r\n"
+        "GET /hello HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: keep-alive\r\n"
+        "Server: libnet/0.0.1\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nConnection: close\r\nServer: libnet/0.0.1\r\n\r\n"
+        "hello",
+    },
+    {
+        "head then get, streamed",
+        "HEAD /stream HTTP/1.1\r\nHost: x\r\n\r\n"
+        "GET /stream HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n"
+        "Transfer-Encoding: chunked\r\nServer: libnet/0.0.1\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nConnection: close\r\n"
+        "Transfer-Encoding: chunked\r\nServer: libnet/0.0.1\r\n\r\n"
+        "3\r\nhel\r\n2\r\nlo\r\n0\r\n\r\n",
+    },
+    {
+        "equal Content-Length twice",
+        "POST /hello HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n"
+        "Connection: close\r\n\r\nabc",
+        "HTTP/1.1 200 OK\r\nConnection: close\r\nServer: libnet/0.0.1\r\n\r\n"
+        "hello",
+    },
+    {
+        "different Content-Length",
+        "POST /hello HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n"
+        "\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "Content-Length not a number",
+        "POST /hello HTTP/1.1\r\nContent-Length: 3x\r\n\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "Content-Length with a sign",
+        "POST /hello HTTP/1.1\r\nContent-Length: +3\r\n\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "Content-Length with Transfer-Encoding",
+        "POST /hello HTTP/1.1\r\nContent-Length: 3\r\n"
+        "Transfer-Encoding: chunked\r\n\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "Transfer-Encoding twice",
+        "POST /hello HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+        "Transfer-Encoding: chunked\r\n\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "Transfer-Encoding not ending in chunked",
+        "POST /hello HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "space before colon",
+        "POST /hello HTTP/1.1\r\nContent-Length : 3\r\n\r\nabc",
+        "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+        "Server: libnet/0.0.1\r\n\r\n",
+    },
+    {
+        "stream ended by a timer after more input",
+        "GET /later HTTP/1.1\r\nHost: x\r\nX-Tag: abc\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n"
+        "Transfer-Encoding: chunked\r\nServer: libnet/0.0.1\r\n\r\n"
+        "a\r\n/later abc\r\n0\r\n\r\n"
+        "HTTP/1.1 200 OK\r\nConnection: close\r\nServer: libnet/0.0.1\r\n\r\n"
+        "hello",
+        "GET /hello HTTP/1.1\r\nHost: zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz\r\n"
+        "Connection: close\r\n\r\n",
+    },
+    {NULL, NULL, NULL, NULL}
+};
+
+
+void http_request_hello(http_request_t *req, http_response_t *res)
+{
+    net_buf_t *buf = net_buf_alloc(res->conn->loop, 0);
+
+    net_buf_append(buf, "hello");
+    http_res_set_body(res, buf);
+}
+
+
+void http_request_stream(http_request_t *req, http_response_t *res)
+{
+    http_res_write(res, "hel", 3);
+    http_res_write(res, "lo", 2);
+    http_res_end(res);
+}
+
+
+// the request is read back long after its bytes left inbuf.
+void http_later_end(net_timer_t *t)
+{
+    char buf[64];
+    http_response_t *res = net_timer_data(t);
+    http_request_t *req = res->req;
+
+    snprintf(buf, sizeof(buf), "%s %s", req->path,
+            http_find_header(&req->headers, "X-Tag"));
+    http_res_write(res, buf, strlen(buf));
+    http_res_end(res);
+    net_timer_destroy(t);
+}
+
+
+void http_later_abort(http_response_t *res, void *arg)
+{
+    if (res->aborted) net_timer_destroy(arg);
+}
+
+
+void http_request_later(http_request_t *req, http_response_t *res)
+{
+    net_timer_t *t = net_timer_init_ms(res->conn->loop, 2 * TEST_PAUSE, 0);
+
+    net_timer_start(t, http_later_end, res);
+    http_res_set_write_callback(res, http_later_abort, t);
+    http_res_write(res, NULL, 0);
+}
+
+
+void *http_test_server(void *arg)
+{
+    http_server_start(arg);
+    return NULL;
+}
+
+
+// send @t's request on a new connection, read the answer into @res
+// until EOF.
+int http_test_send(int port, http_test_t *t, char *res, int size)
+{
+    int fd, n, len = 0;
+    struct sockaddr_in addr;
+    struct timeval tv = {TEST_TIMEOUT, 0};
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            write(fd, t->req, strlen(t->req)) != (ssize_t)strlen(t->req))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (t->more)
+    {
+        usleep(TEST_PAUSE * 1000);
+        if (write(fd, t->more, strlen(t->more)) != (ssize_t)strlen(t->more))
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    while (len < size - 1 && (n = read(fd, res + len, size - 1 - len)) > 0)
+    {
+        len += n;
+    }
+    close(fd);
+
+    // timed out, the server is still waiting for more.
+    if (n < 0) return -1;
+
+    res[len] = '\0';
+    return len;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i, port, failed = 0;
+    char res[4096];
+    pthread_t tid;
+    http_server_t *httpd;
+    http_test_t *t;
+
+    port = argc > 1 ? atoi(argv[1]) : TEST_PORT;
+
+    net_log_level(LOG_ERR);
+
+    if (argc > 2 && strcmp(argv[2], "uring") == 0)
+        net_loop_engine(NET_ENGINE_URING);
+
+    httpd = http_server_init("127.0.0.1", port, 1);
+    http_add_route(httpd, "/hello", http_request_hello);
+    http_add_route(httpd, "/stream", http_request_stream);
+    http_add_route(httpd, "/later", http_request_later);
+
+    if (pthread_create(&tid, NULL, http_test_server, httpd))
+    {
+        logerr("start server failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; http_tests[i].name; i++)
+    {
+        t = &http_tests[i];
+
+        if (http_test_send(port, t, res, sizeof(res)) < 0)
+        {
+            printf("FAIL %s: no answer\n", t->name);
+            failed++;
+        }
+        else if (strcmp(res, t->res) != 0) {
+            printf("FAIL %s:\n%s\n", t->name, res);
+            failed++;
+        }
+        else {
+            printf("ok   %s\n", t->name);
+        }
+    }
+
+    printf("%d/%d passed\n", i - failed, i);
+
+    // the server thread goes down with us.
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
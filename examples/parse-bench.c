@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+#include "util.h"
+
+/*
+ * Microbenchmark of http_request_parse() against the byte by byte parser
+ * it replaced (copied below as legacy_*), with every util_scan() level
+ * the cpu supports.
+ */
+
+#define BENCH_ROUNDS 500000
+
+const char *bench_req =
+    "GET /static/css/site.css?v=20240611 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:126.0) Gecko/20100101 Firefox/126.0\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://www.example.com/articles/2024/06/some-long-article-title\r\n"
+    "Cookie: session=6b1f0c2d9e8a4f7b; theme=dark; _ga=GA1.2.1234567890.1718000000\r\n"
+    "Connection: keep-alive\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-None-Match: \"5e1-18ff4c3a2b0\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+typedef char *(*parse_fn)(http_request_t *, char *, int);
+
+
+void legacy_add_header(http_request_t *req, char *start, char *colon, char *end)
+{
+    http_header_t *h = calloc(1, sizeof(http_header_t));
+
+    h->header_name = start;
+    *(colon) = '\0';
+
+    h->header_value = colon + 2;
+    *(end) = '\0';
+
+    list_add(&req->headers, &h->node);
+}
+
+
+void legacy_request_line(http_request_t *req, char *start, int size)
+{
+    int left_len;
+    char *first_space, *second_space, *crlf;
+
+    first_space = util_strchr(start, ' ', size);
+    if (!first_space) goto fail;
+
+    if (strncmp(start, "GET", 3))
+        req->method = HTTP_GET;
+    else if (strncmp(start, "POST", 4))
+        req->method = HTTP_POST;
+    else if (strncmp(start, "HEAD", 4))
+        req->method = HTTP_HEAD;
+    else
+        goto fail;
+
+    left_len = size - (first_space + 1 - start);
+    second_space = util_strchr(first_space + 1, ' ', left_len);
+    if (!second_space) goto fail;
+
+    req->path = first_space + 1;
+    *(second_space) = '\0';
+
+    left_len = size - (second_space + 1 - start);
+    crlf = util_strstr(second_space + 1, "\r\n", left_len);
+    if (*(crlf - 1) == '1')
+        req->version = 1;
+    else if (*(crlf - 1) == '0')
+        req->version = 0;
+    else
+        goto fail;
+
+    return;
+
+fail:
+    req->error = 1;
+}
+
+
+char *legacy_request_parse(http_request_t *req, char *last, int size)
+{
+    char *crlf = NULL, *colon, *start = last;
+    int has_more = 1;
+
+    while (has_more)
+    {
+        if (req->parse_state == HTTP_PARSE_REQ_LINE)
+        {
+            crlf = util_strstr(last, "\r\n", size - (last - start));
+            if (crlf)
+            {
+                legacy_request_line(req, last, crlf - last + 2);
+                if (req->error) return NULL;
+                req->parse_state = HTTP_PARSE_HEADER;
+                last = crlf + 2;
+            }
+            else {
+                has_more = 0;
+            }
+        }
+        else if (req->parse_state == HTTP_PARSE_HEADER)
+        {
+            crlf = util_strstr(last, "\r\n", size - (last - start));
+            if (crlf)
+            {
+                colon = util_strchr(last, ':', crlf - last);
+                if (colon)
+                {
+                    legacy_add_header(req, last, colon, crlf);
+                }
+                else {
+                    req->parse_state = HTTP_PARSE_DONE;
+                    has_more = 0;
+                }
+                last = crlf + 2;
+            }
+            else {
+                has_more = 0;
+            }
+        }
+        else {
+            has_more = 0;
+        }
+    }
+
+    return last;
+}
+
+
+// ns per request, header block wait and parse included.
+double bench(parse_fn parse, int legacy)
+{
+    int i, len = strlen(bench_req);
+    char buf[2048];
+    struct timespec t0, t1;
+    http_request_t *req;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+        memcpy(buf, bench_req, len + 1);
+
+        if (legacy)
+        {
+            if (!util_strstr(buf, "\r\n\r\n", len)) return -1;
+        }
+        else if (!http_header_end(buf, len)) return -1;
+
+        req = http_request_init(NULL, NULL);
+        if (parse(req, buf, len) != buf + len ||
+                req->parse_state != HTTP_PARSE_DONE)
+        {
+            logerr("parse failed.\n");
+            return -1;
+        }
+        http_request_free(req);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec))
+        / BENCH_ROUNDS;
+}
+
+
+// both parsers must agree on every header.
+int check(void)
+{
+    int len = strlen(bench_req);
+    char a[2048], b[2048];
+    list_t *iter;
+    http_header_t *h;
+    const char *v;
+    http_request_t *old = http_request_init(NULL, NULL);
+    http_request_t *new = http_request_init(NULL, NULL);
+
+    memcpy(a, bench_req, len + 1);
+    memcpy(b, bench_req, len + 1);
+    legacy_request_parse(old, a, len);
+    http_request_parse(new, b, len);
+
+    if (strcmp(old->path, new->path) || old->version != new->version)
+        return NET_ERR;
+
+    LIST_FOR_EACH(&old->headers, iter)
+    {
+        h = container_of(iter, http_header_t, node);
+        v = http_find_header(&new->headers, h->header_name);
+        if (!v || strcmp(v, h->header_value)) return NET_ERR;
+    }
+
+    http_request_free(old);
+    http_request_free(new);
+    return NET_OK;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int level;
+    const char *names[] = {"scalar", "sse2", "avx2"};
+
+    if (check() != NET_OK)
+    {
+        logerr("parsers disagree.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("request: %d bytes, rounds: %d\n", (int)strlen(bench_req),
+            BENCH_ROUNDS);
+    printf("%-8s %8.1f ns/req\n", "legacy", bench(legacy_request_parse, 1));
+
+    for (level = UTIL_SCAN_SCALAR; level <= UTIL_SCAN_AVX2; level++)
+    {
+        if (util_scan_level(level) != level) break;
+        printf("%-8s %8.1f ns/req\n", names[level],
+                bench(http_request_parse, 0));
+    }
+
+    return 0;
+}
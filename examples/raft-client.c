@@ -63,7 +63,7 @@ void send_req(net_connect_t *c, void *arg)
         net_buf_copy(buf, kv->value, strlen(kv->value));
     }
 
-    list_append(&c->outbuf, &buf->node);
+    net_connection_append(c, buf);
     net_connection_send(c);
 }
 
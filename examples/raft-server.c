@@ -9,6 +9,11 @@
 #include "net.h"
 #include "hash.h"
 
+// election timeout is random within [MIN, MAX), heartbeat well below it
+#define RAFT_ELECTION_MIN_MS 150
+#define RAFT_ELECTION_MAX_MS 300
+#define RAFT_HEARTBEAT_MS    50
+
 struct raft_log_entry_cmd
 {
     void *buf;
@@ -144,9 +149,9 @@ char* raft_state(int s)
 // we only need to call random() when a real election occurs.
 int random_ElecttionTimeout()
 {
-    // TODO: align to paper's suggested value
-    int timeout = 10 + random() % 10;
-    loginfo("random ElecttionTimeout (in seconds): %d\n", timeout);
+    int timeout = RAFT_ELECTION_MIN_MS +
+        random() % (RAFT_ELECTION_MAX_MS - RAFT_ELECTION_MIN_MS);
+    loginfo("random ElecttionTimeout (in ms): %d\n", timeout);
     return timeout;
 }
 
@@ -163,7 +168,7 @@ void _RequestVote_receiver(net_connect_t *c, int term, int voteGranted)
     loginfo("RequestVote results: term(%u), voteGranted(%u).\n",
             term, voteGranted);
 
-    list_append(&c->outbuf, &reply->node);
+    net_connection_append(c, reply);
     net_connection_send(c);
 }
 
@@ -245,7 +250,7 @@ void RequestVote_receiver(net_connect_t *c, uint32_t *res)
                         raft_state(rs->state), rs->id, candidateId, term);
                 rs->votedFor = candidateId;
                 raft_persist_votedFor(rs);
-                net_timer_reset(rs->election_timer,
+                net_timer_reset_ms(rs->election_timer,
                         random_ElecttionTimeout(), 0);
             }
         }
@@ -270,7 +275,7 @@ void _AppendEntries_receiver(net_connect_t *c, int term, int success)
     loginfo("AppendEntries results: term(%u), success(%u).\n",
             term, success);
 
-    list_append(&c->outbuf, &reply->node);
+    net_connection_append(c, reply);
     net_connection_send(c);
 }
 
@@ -553,7 +558,7 @@ void AppendEntries_receiver(net_connect_t *c, uint32_t *res)
             else {
                 loginfo("log term not match\n");
                 _AppendEntries_receiver(c, rs->currentTerm, 0);
-                net_timer_reset(rs->election_timer,
+                net_timer_reset_ms(rs->election_timer,
                         random_ElecttionTimeout(), 0);
                 return;
             }
@@ -561,7 +566,8 @@ void AppendEntries_receiver(net_connect_t *c, uint32_t *res)
         else {
             loginfo("log index not match\n");
             _AppendEntries_receiver(c, rs->currentTerm, 0);
-            net_timer_reset(rs->election_timer, random_ElecttionTimeout(), 0);
+            net_timer_reset_ms(rs->election_timer,
+                    random_ElecttionTimeout(), 0);
             return;
         }
 
@@ -592,7 +598,8 @@ void AppendEntries_receiver(net_connect_t *c, uint32_t *res)
         }
 
         _AppendEntries_receiver(c, rs->currentTerm, 1);
-        net_timer_reset(rs->election_timer, random_ElecttionTimeout(), 0);
+        net_timer_reset_ms(rs->election_timer,
+                random_ElecttionTimeout(), 0);
     }
 
     uint32_t leaderCommit = ntohl(*(uint32_t*)cur);
@@ -961,7 +968,7 @@ void __AppendEntries_invoke(net_connect_t *c, void *arg)
             _prevLogTerm, rs->inFlight[peer_id], rs->commitIndex);
 
     // send to wire
-    list_append(&c->outbuf, &reply->node);
+    net_connection_append(c, reply);
     net_connection_send(c);
 
     net_client_set_response_callback(c->client, ___AppendEntries_invoke);
@@ -1003,10 +1010,12 @@ void raft_leader_heartbeat(net_loop_t *loop, struct raft_server *rs)
 {
     if (rs->heartbeat_timer)
     {
-        net_timer_reset(rs->heartbeat_timer, 2, 2);
+        net_timer_reset_ms(rs->heartbeat_timer,
+                RAFT_HEARTBEAT_MS, RAFT_HEARTBEAT_MS);
     }
     else {
-        rs->heartbeat_timer = net_timer_init(loop, 2, 2);
+        rs->heartbeat_timer = net_timer_init_ms(loop,
+                RAFT_HEARTBEAT_MS, RAFT_HEARTBEAT_MS);
         net_timer_start(rs->heartbeat_timer, AppendEntries_invoke_empty, rs);
     }
 }
@@ -1066,7 +1075,8 @@ void raft_log_replication(struct raft_server *rs,
         struct raft_peer *peer = &rs->cluster->peers[i];
         _AppendEntries_invoke(rs, peer, entry);
     }
-    net_timer_reset(rs->heartbeat_timer, 2, 2);
+    net_timer_reset_ms(rs->heartbeat_timer,
+            RAFT_HEARTBEAT_MS, RAFT_HEARTBEAT_MS);
 }
 
 int __RequestVote_invoke(char *start, size_t size, net_connect_t *c)
@@ -1162,7 +1172,7 @@ void _RequestVote_invoke(net_connect_t *c, void *arg)
             rs->id, rs->lastLogIndex, rs->lastLogTerm);
 
     // send RequestVote RPC
-    list_append(&c->outbuf, &reply->node);
+    net_connection_append(c, reply);
     net_connection_send(c);
 
     net_client_set_response_callback(c->client, __RequestVote_invoke);
@@ -1213,7 +1223,7 @@ void start_election(net_timer_t *election_timer)
     }
 
     // in case of split votes
-    net_timer_reset(election_timer, random_ElecttionTimeout(), 0);
+    net_timer_reset_ms(election_timer, random_ElecttionTimeout(), 0);
 }
 
 void bind_raft_server(net_connect_t *c, void *arg)
@@ -1256,7 +1266,7 @@ void client_response(void *arg)
 
     if (!c->err)
     {
-        list_append(&c->outbuf, &reply->node);
+        net_connection_append(c, reply);
         // NOTE: we don't close connection here, because we are
         // SERVER, we take an PASSIVE behaivor.
         net_connection_send(c);
@@ -1384,7 +1394,7 @@ int main(int argc, char *argv[])
     rs->inFlight = calloc(rs->cluster->number, sizeof(int));
 
     srandom(time(NULL) + node_id);
-    net_timer_t *timer = net_timer_init(loop, random_ElecttionTimeout(), 0);
+    net_timer_t *timer = net_timer_init_ms(loop, random_ElecttionTimeout(), 0);
     net_timer_start(timer, start_election, rs);
     rs->election_timer = timer;
     rs->heartbeat_timer = NULL;
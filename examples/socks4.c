@@ -23,9 +23,9 @@ int on_server_msg(char *start, size_t size, net_connect_t *c)
     if (size <= 0) return NET_AGAIN;
 
     // server -> socks4 -> client
-    to_client = net_buf_create(0);
+    to_client = net_buf_alloc(c->loop, size);
     net_buf_copy(to_client, start, size);
-    list_append(&server_conn->outbuf, &to_client->node);
+    net_connection_append(server_conn, to_client);
 
     logdebug("upstream -> client, size: %ld\n", size);
     net_connection_send(server_conn);
@@ -39,7 +39,12 @@ void on_server_close(net_connect_t *c, void *arg)
 {
     logdebug("server side closed\n");
     net_connect_t *client_conn = arg;
-    net_connection_close(client_conn);
+
+    // unbind, then close client side once what server sent is flushed.
+    client_conn->data = NULL;
+    net_connection_suspend(client_conn);
+    net_connection_set_close(client_conn);
+    if (list_empty(&client_conn->outbuf)) net_connection_close(client_conn);
 }
 
 
@@ -108,10 +113,13 @@ void socks4_reply(net_connect_t *c, void *arg)
     memcpy(buf+4, &addr.s_addr, 4);
 
     // socks4 reply to peer-client
-    reply = net_buf_create(0);
+    reply = net_buf_alloc(peer_client->loop, 0);
     net_buf_copy(reply, buf, sizeof(buf));
-    list_append(&peer_client->outbuf, &reply->node);
+    net_connection_append(peer_client, reply);
     net_connection_send(peer_client);
+
+    // handshake done, relay both ways kernel-side.
+    if (!c->err) net_connection_pipe(peer_client, c);
 }
 
 int on_client_msg(char *start, size_t size, net_connect_t *c)
@@ -125,6 +133,9 @@ int on_client_msg(char *start, size_t size, net_connect_t *c)
     if (size <= 0) return NET_AGAIN;
     parsed_bytes = size;
 
+    // server side already closed, drop it.
+    if (c->closing) return size;
+
     if (!client_conn)
     {
         ret = socks4_parse(start, size, &peer_server);
@@ -142,6 +153,10 @@ int on_client_msg(char *start, size_t size, net_connect_t *c)
 
             // bind server with client
             c->data = client->conn;
+
+            // each side reads no faster than the other one drains.
+            net_connection_throttle(client->conn, c);
+            net_connection_throttle(c, client->conn);
         }
         else if (ret == NET_AGAIN) {
             parsed_bytes = 0;
@@ -153,9 +168,9 @@ int on_client_msg(char *start, size_t size, net_connect_t *c)
     }
     else {
         // client -> socks4 -> server
-        to_server = net_buf_create(0);
+        to_server = net_buf_alloc(c->loop, size);
         net_buf_copy(to_server, start, size);
-        list_append(&client_conn->outbuf, &to_server->node);
+        net_connection_append(client_conn, to_server);
 
         logdebug("client -> upstream, size: %ld\n", size);
         net_connection_send(client_conn);
@@ -17,10 +17,13 @@ int on_client_msg(char *start, size_t size, net_connect_t *c)
 
     if (size <= 0) return NET_AGAIN;
 
+    // server side already closed, drop it.
+    if (client_conn == NULL) return size;
+
     // client -> relay -> server
-    to_server = net_buf_create(0);
+    to_server = net_buf_alloc(c->loop, size);
     net_buf_copy(to_server, start, size);
-    list_append(&client_conn->outbuf, &to_server->node);
+    net_connection_append(client_conn, to_server);
     net_connection_send(client_conn);
 
     return size;
@@ -36,9 +39,9 @@ int on_server_msg(char *start, size_t size, net_connect_t *c)
     if (size <= 0) return NET_AGAIN;
 
     // server -> relay -> client
-    to_client = net_buf_create(0);
+    to_client = net_buf_alloc(c->loop, size);
     net_buf_copy(to_client, start, size);
-    list_append(&server_conn->outbuf, &to_client->node);
+    net_connection_append(server_conn, to_client);
     net_connection_send(server_conn);
 
     return size;
@@ -49,7 +52,11 @@ void on_server_close(net_connect_t *c, void *arg)
 {
     loginfo("[conn: %p, fd: %d] server side closed\n", c, c->io_watcher.fd);
     net_connect_t *client_conn = arg;
-    net_connection_close(client_conn);
+
+    // unbind, then close client side once what server sent is flushed.
+    client_conn->data = NULL;
+    net_connection_set_close(client_conn);
+    if (list_empty(&client_conn->outbuf)) net_connection_close(client_conn);
 }
 
 
@@ -57,7 +64,18 @@ void on_client_close(net_connect_t *c, void *arg)
 {
     loginfo("[conn: %p, fd: %d] client side closed\n", c, c->io_watcher.fd);
     net_connect_t *server_conn = c->data;
-    net_connection_close(server_conn);
+    if (server_conn) net_connection_close(server_conn);
+}
+
+
+void on_server_connect(net_connect_t *c, void *arg)
+{
+    net_connect_t *client_conn = arg;
+
+    if (c->err) return;
+
+    // from now on bytes flow kernel-side, on_*_msg no longer sees them.
+    net_connection_pipe(client_conn, c);
 }
 
 
@@ -70,8 +88,13 @@ void relay_accept_cb(net_connect_t *c, void *arg)
     net_client_set_user_data(client, c); // bind client with server
     net_client_set_response_callback(client, on_server_msg);
     net_client_set_close_callback(client, on_server_close, c);
+    net_client_set_connection_callback(client, on_server_connect, c);
 
     c->data = client->conn; // bind server with client
+
+    // each side reads no faster than the other one drains.
+    net_connection_throttle(client->conn, c);
+    net_connection_throttle(c, client->conn);
 }
 
 
@@ -2,38 +2,44 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
 
 #include "http.h"
+#include "route.h"
 #include "util.h"
 
 
 void http_add_route(http_server_t *server, char *path, http_handler handler)
 {
-    http_route_t *r = malloc(sizeof(http_route_t));
-    list_init(&r->node);
-    r->url_handler = handler;
-    r->url_path = path;
-    list_add(&server->routes, &r->node);
+    http_add_route_data(server, path, handler, NULL);
 }
 
 
-http_handler http_dispatch_route(http_server_t *s, http_request_t *req)
+// @data is handed to @handler as req->route_data.
+void http_add_route_data(http_server_t *server, char *path,
+        http_handler handler, void *data)
 {
-    list_t *iter;
-    http_route_t *r;
-    http_handler matched = NULL;
+    http_add_route_method(server, HTTP_ANY, path, handler, data);
+}
 
-    LIST_FOR_EACH(&s->routes, iter)
-    {
-        r = container_of(iter, http_route_t, node);
-        if (strncmp(r->url_path, req->path, strlen(r->url_path)) == 0)
-        {
-            matched = r->url_handler;
-            break;
-        }
-    }
 
-    return matched;
+/* @path is matched as a whole, "/users/:id" takes any segment after
+ * "/users/", and a trailing '*' makes it a prefix. See route.h. */
+void http_add_route_method(http_server_t *server, int method, char *path,
+        http_handler handler, void *data)
+{
+    http_route_add(server->routes, method, path, handler, NULL, data);
+}
+
+
+/* Like http_add_route_method(), the request body is handed to @on_body
+ * as it arrives instead of being buffered, @handler runs after its end. */
+void http_add_body_route(http_server_t *server, int method, char *path,
+        http_body_handler on_body, http_handler handler, void *data)
+{
+    http_route_add(server->routes, method, path, handler, on_body, data);
 }
 
 
@@ -66,14 +72,14 @@ http_response_t *http_response_init(net_connect_t *c)
 }
 
 
-void http_send(http_response_t *res)
+// status line and headers of @res.
+net_buf_t *http_res_header(http_response_t *res)
 {
     net_buf_t  *header;
     list_t *iter;
     http_header_t *h;
 
-    // header
-    header = net_buf_create(0);
+    header = net_buf_alloc(res->conn->loop, 0);
     net_buf_append(header,
             "HTTP/1.1 %d %s\r\n", res->status_code, res->status_msg);
 
@@ -87,34 +93,74 @@ void http_send(http_response_t *res)
         net_buf_append(header, "\r\n");
     }
     net_buf_append(header, "\r\n");
-    list_append(&res->conn->outbuf, &header->node);
+
+    return header;
+}
+
+
+void http_send(http_response_t *res)
+{
+    // header
+    net_connection_append(res->conn, http_res_header(res));
+
+    // HEAD gets the header GET would, Content-Length included, no body.
+    if (res->req->method == HTTP_HEAD)
+    {
+        if (res->body) net_buf_del(res->body);
+        if (res->file) net_buf_del(res->file);
+        res->body = res->file = NULL;
+        return;
+    }
 
     // body
     if (res->body)
     {
-        list_append(&res->conn->outbuf, &res->body->node);
+        net_connection_append(res->conn, res->body);
+    }
+    if (res->file)
+    {
+        net_connection_append(res->conn, res->file);
     }
 }
 
 
-void http_destroy(http_request_t *req, http_response_t *res)
+void http_request_free(http_request_t *req)
 {
     list_t *iter, *next;
     http_header_t *h;
 
+    // only headers past the inline slots were allocated.
     LIST_FOR_EACH_SAFE(&req->headers, iter, next)
     {
         h = container_of(iter, http_header_t, node);
-        free(h);
+        if (h < req->header_slots || h >= req->header_slots + HTTP_HEADER_SLOTS)
+            free(h);
     }
 
+    // aborted while its body was streamed.
+    if (req->on_body && req->parse_state == HTTP_PARSE_BODY)
+        req->on_body(req, NULL, 0);
+
+    if (req->body_buf) net_buf_del(req->body_buf);
+    free(req->params_buf);
+    free(req->head);
+    free(req);
+}
+
+
+void http_destroy(http_request_t *req, http_response_t *res)
+{
+    list_t *iter, *next;
+    http_header_t *h;
+
+    http_request_free(req);
+
     LIST_FOR_EACH_SAFE(&res->headers, iter, next)
     {
         h = container_of(iter, http_header_t, node);
         free(h);
     }
 
-    free(req);
     free(res);
 }
 
@@ -153,11 +199,24 @@ int http_res_have_body(http_response_t *res)
 {
     if (res->body && res->body->pos > 0)
         return 1;
+    else if (res->file && res->file->pos > 0)
+        return 1;
     else
         return 0;
 }
 
 
+int http_res_body_size(http_response_t *res)
+{
+    int size = 0;
+
+    if (res->body) size += res->body->pos;
+    if (res->file) size += res->file->pos;
+
+    return size;
+}
+
+
 void http_res_set_body(http_response_t *res, net_buf_t *buf)
 {
     res->body = buf;
@@ -165,14 +224,56 @@ void http_res_set_body(http_response_t *res, net_buf_t *buf)
 }
 
 
+/* Respond with @len bytes of @fd from @offset, sent by sendfile() without
+ * copying to user space. @fd is owned by the response from now on. */
+int http_res_set_file(http_response_t *res, int fd, off_t offset, int len)
+{
+    net_buf_t *file = net_buf_file(fd, offset, len);
+
+    if (file == NULL)
+    {
+        logerr("file segment alloc failed.\n");
+        close(fd);
+        return NET_ERR;
+    }
+
+    http_res_set_file_buf(res, file);
+    return NET_OK;
+}
+
+
+// like http_res_set_file(), for a segment from net_buf_file().
+void http_res_set_file_buf(http_response_t *res, net_buf_t *file)
+{
+    if (res->file) net_buf_del(res->file);
+    res->file = file;
+    res->body_size = http_res_body_size(res);
+}
+
+
 void http_add_header(http_request_t *req, char *start, char *colon, char *end)
 {
-    http_header_t *h = calloc(1, sizeof(http_header_t));
+    http_header_t *h;
+    char *value = colon + 1;
+
+    // optional whitespace around the value isn't part of it.
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+    if (req->nheaders < HTTP_HEADER_SLOTS)
+    {
+        h = &req->header_slots[req->nheaders];
+    }
+    else {
+        h = calloc(1, sizeof(http_header_t));
+        if (h == NULL) return;
+    }
+    req->nheaders++;
 
     h->header_name = start;
     *(colon) = '\0';
 
-    h->header_value = colon + 2;
+    h->header_value = value;
     *(end) = '\0';
 
     list_add(&req->headers, &h->node);
@@ -258,62 +359,75 @@ int http_res_keep_alive(http_response_t *res)
 
 void http_accept_cb(net_connect_t *c, void *arg)
 {
-    c->data = arg;
-
-    http_server_t *s = arg;
-
     http_connection_t *http_c = calloc(1, sizeof(http_connection_t));
-    http_c->fd = c->io_watcher.fd;
-    list_init(&http_c->node);
 
-    list_add(&s->http_connections, &http_c->node);
+    if (http_c == NULL)
+    {
+        // requests on @c fail then, see net_request_process().
+        logerr("http connection calloc failed.\n");
+        return;
+    }
+
+    http_c->worker = arg;
+    list_init(&http_c->pending);
+    c->data = http_c;
 }
 
 
-void http_close_cb(net_connect_t *c, void *arg)
+// release answered requests, their responses have left outbuf.
+void http_release_pending(http_connection_t *http_c)
 {
-    list_t *iter, *next;
-    http_connection_t *http_c;
-    http_server_t *s = arg;
+    http_request_t *req;
 
-    LIST_FOR_EACH_SAFE(&s->http_connections, iter, next)
+    while (!list_empty(&http_c->pending))
     {
-        http_c = container_of(iter, http_connection_t, node);
-        if (http_c->fd == c->io_watcher.fd)
-        {
-            list_del(&http_c->node);
-            free(http_c);
-            break;
-        }
+        req = container_of(http_c->pending.next, http_request_t, node);
+        list_del(&req->node);
+        http_destroy(req, req->res);
     }
+    http_c->npending = 0;
 }
 
 
-void http_done_cb(net_connect_t *c, void *arg)
+void http_close_cb(net_connect_t *c, void *arg)
 {
-    http_server_t *s = (http_server_t *)c->data;
-    http_connection_t *http_c = NULL, *tmp_c;
-    list_t *iter;
+    http_connection_t *http_c = c->data;
+    http_response_t *res;
 
-    // match coresponding http-connection
-    LIST_FOR_EACH(&s->http_connections, iter)
+    if (http_c == NULL) return;
+
+    http_release_pending(http_c);
+    if (http_c->req) http_request_free(http_c->req);
+
+    // closed before its end, the producer lets go of it.
+    if (http_c->stream)
     {
-        tmp_c = container_of(iter, http_connection_t, node);
-        if (tmp_c->fd == c->io_watcher.fd)
-        {
-            http_c = tmp_c;
-            break;
-        }
+        res = http_c->stream->res;
+        res->aborted = 1;
+        if (res->on_write) res->on_write(res, res->write_data);
+        http_destroy(http_c->stream, res);
     }
 
+    free(http_c);
+    c->data = NULL;
+}
+
+
+// outbuf is flushed, so is every response queued before.
+void http_done_cb(net_connect_t *c, void *arg)
+{
+    http_connection_t *http_c = c->data;
+
     if (http_c)
     {
-        if (http_res_keep_alive(http_c->res) == 0)
-            net_connection_set_close(c);
+        http_release_pending(http_c);
+        if (http_c->closing) net_connection_set_close(c);
 
-        http_destroy(http_c->req, http_c->res);
-        http_c->req = NULL;
-        http_c->res = NULL;
+        if (http_c->throttled && !http_c->stream)
+        {
+            http_c->throttled = 0;
+            net_connection_resume(c);
+        }
     }
 }
 
@@ -325,63 +439,78 @@ void http_404_process(http_request_t *req, http_response_t *res)
 }
 
 
-void http_request_line(http_request_t *req, char *start, int size)
+struct {
+    const char *name;
+    int len;
+    int method;
+} http_methods[] = {
+    {"GET",     3, HTTP_GET},
+    {"POST",    4, HTTP_POST},
+    {"HEAD",    4, HTTP_HEAD},
+    {"PUT",     3, HTTP_PUT},
+    {"DELETE",  6, HTTP_DELETE},
+    {"OPTIONS", 7, HTTP_OPTIONS},
+    {"PATCH",   5, HTTP_PATCH},
+    {"CONNECT", 7, HTTP_CONNECT},
+    {"TRACE",   5, HTTP_TRACE},
+    {NULL, 0, 0}
+};
+
+
+const char *http_method_name(int method)
+{
+    if (method < 0 || method >= HTTP_ANY) return NULL;
+    return http_methods[method].name;
+}
+
+
+// request line in [@start, @end), without its CRLF.
+void http_request_line(http_request_t *req, char *start, char *end)
 {
-    int left_len;
-    char *first_space, *second_space, *crlf;
+    int i;
+    char *sp, *path;
 
-    first_space = util_strchr(start, ' ', size);
-    if (!first_space)
+    sp = memchr(start, ' ', end - start);
+    if (!sp)
     {
         logerr("no space in request method.\n");
         goto fail;
     }
 
     // fetch http method
-    if (strncmp(start, "GET", 3))
-    {
-        req->method = HTTP_GET;
-    }
-    else if (strncmp(start, "POST", 4))
+    for (i = 0; http_methods[i].name; i++)
     {
-        req->method = HTTP_POST;
+        if (sp - start == http_methods[i].len &&
+                memcmp(start, http_methods[i].name, http_methods[i].len) == 0)
+            break;
     }
-    else if (strncmp(start, "HEAD", 4))
+    if (!http_methods[i].name)
     {
-        req->method = HTTP_HEAD;
-    }
-    else {
-        logerr("unknown http method.\n");
+        logerr("unknown http method: %.*s\n", (int)(sp - start), start);
         goto fail;
     }
+    req->method = http_methods[i].method;
 
     // fetch http url path
-    left_len = size - (first_space + 1 - start);
-    second_space = util_strchr(first_space + 1, ' ', left_len);
-    if (!second_space)
+    path = sp + 1;
+    sp = memchr(path, ' ', end - path);
+    if (!sp || sp == path)
     {
         logerr("no space in request url.\n");
         goto fail;
     }
 
-    req->path = first_space + 1;
-    *(second_space) = '\0';
+    req->path = path;
+    *(sp) = '\0';
 
-    // fetch http version
-    left_len = size - (second_space + 1 - start);
-    crlf = util_strstr(second_space + 1, "\r\n", left_len);
-    if (*(crlf - 1) == '1')
+    // fetch http version, "HTTP/1.x"
+    if (end - sp != 9 || memcmp(sp + 1, "HTTP/1.", 7) != 0 ||
+            (sp[8] != '0' && sp[8] != '1'))
     {
-        req->version = 1;
-    }
-    else if (*(crlf - 1) == '0')
-    {
-        req->version = 0;
-    }
-    else {
-        logerr("unknown http version: %d\n", *(crlf - 1) - '0');
+        logerr("unknown http version: %.*s\n", (int)(end - sp - 1), sp + 1);
         goto fail;
     }
+    req->version = sp[8] - '0';
 
     return;
 
@@ -391,87 +520,568 @@ fail:
 }
 
 
+/* Parse what's complete in @last[0, size), return where parsing stopped,
+ * NULL on malformed input. Header names and values are NUL-terminated in
+ * place, nothing is copied. */
 char* http_request_parse(http_request_t *req, char *last, int size)
 {
-    char *crlf = NULL, *colon, *start;
-    int has_more = 1;
-
-    // save starting point.
-    start = last;
+    char *p, *cr, *end = last + size;
 
-    while (has_more)
+    while (req->parse_state == HTTP_PARSE_REQ_LINE ||
+            req->parse_state == HTTP_PARSE_HEADER)
     {
+        // urls may hold ':', the request line only ends at CR (or LF).
         if (req->parse_state == HTTP_PARSE_REQ_LINE)
+            p = cr = util_scan(last, end - last, '\r', '\n', '\r');
+        else
+            p = cr = util_scan(last, end - last, ':', '\r', '\n');
+
+        // values may hold ':' but no LF, a bare one ends the line too.
+        if (p && *p == ':')
+            cr = util_scan(p + 1, end - p - 1, '\r', '\n', '\r');
+
+        // line not complete yet
+        if (!cr || cr + 1 >= end) break;
+
+        if (*cr != '\r' || cr[1] != '\n')
+        {
+            logerr("http line not ended with CRLF.\n");
+            return NULL;
+        }
+
+        if (req->parse_state == HTTP_PARSE_REQ_LINE)
+        {
+            http_request_line(req, last, cr);
+            if (req->error) return NULL;
+            req->parse_state = HTTP_PARSE_HEADER;
+        }
+        else if (cr == last) {
+            // empty line, end of headers
+            req->parse_state = HTTP_PARSE_DONE;
+        }
+        else if (p == cr || p == last || p[-1] == ' ' || p[-1] == '\t') {
+            // no space before ':', a name some peers would trim.
+            logerr("bad http header line.\n");
+            return NULL;
+        }
+        else {
+            http_add_header(req, last, p, cr);
+        }
+
+        last = cr + 2;
+    }
+
+    return last;
+}
+
+
+// end of the header block in @start[0, size), NULL if not all buffered.
+char *http_header_end(char *start, int size)
+{
+    char *p = start, *end = start + size;
+
+    while (end - p >= 4 && (p = memchr(p, '\r', end - p - 3)))
+    {
+        if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') return p;
+        p++;
+    }
+
+    return NULL;
+}
+
+
+// LF without CR in @start[0, size), such a header would never end.
+int http_bare_lf(char *start, int size)
+{
+    char *p = start, *end = start + size;
+
+    while ((p = memchr(p, '\n', end - p)))
+    {
+        if (p == start || p[-1] != '\r') return 1;
+        p++;
+    }
+
+    return 0;
+}
+
+
+/* Body framing given by the header, see RFC 9112 section 6. Every
+ * Content-Length and Transfer-Encoding counts, a proxy going by another
+ * one than we do would split requests elsewhere (request smuggling). */
+int http_request_framing(http_request_t *req)
+{
+    int nte = 0;
+    long len = -1, n;
+    char *end;
+    const char *te = NULL;
+    list_t *iter;
+    http_header_t *h;
+
+    LIST_FOR_EACH(&req->headers, iter)
+    {
+        h = container_of(iter, http_header_t, node);
+
+        if (strcasecmp(h->header_name, "Transfer-Encoding") == 0)
         {
-            crlf = util_strstr(last, "\r\n", size-(last-start));
-            if (crlf)
+            te = h->header_value;
+            nte++;
+        }
+        else if (strcasecmp(h->header_name, "Content-Length") == 0) {
+            errno = 0;
+            n = strtol(h->header_value, &end, 10);
+            if (*h->header_value < '0' || *h->header_value > '9' ||
+                    *end || errno || (len >= 0 && n != len))
             {
-                http_request_line(req, last, crlf-last+2);
-                if (req->error) return NULL;
-                req->parse_state = HTTP_PARSE_HEADER;
-                last = crlf + 2;
-            }
-            else {
-                has_more = 0;
+                logerr("bad content length: %s\n", h->header_value);
+                return NET_ERR;
             }
+            len = n;
         }
-        else if (req->parse_state == HTTP_PARSE_HEADER)
+    }
+
+    if (te)
+    {
+        // with both, peers may disagree on where the body ends.
+        if (nte > 1 || len >= 0 || strcasecmp(te, "chunked") != 0)
         {
-            crlf = util_strstr(last, "\r\n", size-(last-start));
-            if (crlf)
+            logerr("unsupported transfer encoding: %s\n", te);
+            return NET_ERR;
+        }
+        req->body_type = HTTP_BODY_CHUNKED;
+        req->chunk_state = HTTP_CHUNK_SIZE;
+    }
+    else if (len > 0) {
+        req->body_left = len;
+        req->body_type = HTTP_BODY_LENGTH;
+    }
+
+    return NET_OK;
+}
+
+
+// body piece left in inbuf goes to body_buf, inbuf may be reused.
+int http_body_keep(http_request_t *req)
+{
+    net_buf_t *b;
+
+    if (req->body == NULL || req->body_buf) return NET_OK;
+
+    b = net_buf_alloc(req->conn->loop, 0);
+    if (net_buf_reserve(b, req->body_size, req->body_size + 1) < req->body_size)
+    {
+        logerr("request body alloc failed.\n");
+        net_buf_del(b);
+        return NET_ERR;
+    }
+    net_buf_copy(b, req->body, req->body_size);
+
+    req->body_buf = b;
+    req->body = b->buf;
+    return NET_OK;
+}
+
+
+// decoded body piece, streamed or buffered.
+int http_body_data(http_request_t *req, char *data, int n)
+{
+    net_buf_t *b;
+
+    if (req->on_body)
+    {
+        req->body_size += n;
+        return req->on_body(req, data, n);
+    }
+
+    if (req->body_size + n > req->http_server->max_body)
+    {
+        req->reject = 413;
+        return NET_ERR;
+    }
+
+    // a body read at once is left where it is.
+    if (req->body == NULL)
+    {
+        req->body = data;
+        req->body_size = n;
+        return NET_OK;
+    }
+
+    if (http_body_keep(req) != NET_OK) return NET_ERR;
+
+    b = req->body_buf;
+    if (net_buf_reserve(b, n, req->http_server->max_body + 1) < n)
+    {
+        logerr("request body alloc failed.\n");
+        return NET_ERR;
+    }
+    net_buf_copy(b, data, n);
+
+    req->body = b->buf;
+    req->body_size += n;
+    return NET_OK;
+}
+
+
+/* Decode what's complete of the body in @start[0, size), return bytes
+ * consumed, NET_ERR on malformed input. parse_state is HTTP_PARSE_DONE once
+ * the whole body went through http_body_data(). */
+int http_request_body(http_request_t *req, char *start, int size)
+{
+    long n;
+    char *p = start, *end = start + size, *lf, *hex;
+
+    while (req->parse_state == HTTP_PARSE_BODY)
+    {
+        if (req->body_type == HTTP_BODY_LENGTH ||
+                req->chunk_state == HTTP_CHUNK_DATA)
+        {
+            n = end - p < req->body_left ? end - p : req->body_left;
+            if (n == 0) break;
+
+            if (http_body_data(req, p, n) != NET_OK) return NET_ERR;
+            p += n;
+            req->body_left -= n;
+            if (req->body_left) break;
+
+            if (req->body_type == HTTP_BODY_LENGTH)
+                req->parse_state = HTTP_PARSE_DONE;
+            else
+                req->chunk_state = HTTP_CHUNK_CRLF;
+            continue;
+        }
+
+        // chunk size, CRLF after chunk data and trailer are whole lines.
+        lf = memchr(p, '\n', end - p);
+        if (!lf)
+        {
+            if (end - p <= HTTP_CHUNK_LINE_MAX) break;
+            logerr("chunk line too long.\n");
+            return NET_ERR;
+        }
+        if (lf == p || lf[-1] != '\r')
+        {
+            logerr("chunk line not ended with CRLF.\n");
+            return NET_ERR;
+        }
+
+        if (req->chunk_state == HTTP_CHUNK_SIZE)
+        {
+            // extensions after ';' are ignored.
+            for (hex = p, n = 0; hex < lf - 1; hex++)
             {
-                colon = util_strchr(last, ':', size-(last-start));
-                if (colon)
-                {
-                    http_add_header(req, last, colon, crlf);
-                }
-                else {
-                    req->parse_state = HTTP_PARSE_DONE;
-                    has_more = 0;
-                }
-                last = crlf + 2;
+                if (*hex >= '0' && *hex <= '9') n = n * 16 + *hex - '0';
+                else if (*hex >= 'a' && *hex <= 'f') n = n * 16 + *hex - 'a' + 10;
+                else if (*hex >= 'A' && *hex <= 'F') n = n * 16 + *hex - 'A' + 10;
+                else break;
+
+                if (n > INT_MAX) break;
             }
-            else {
-                has_more = 0;
+            if (hex == p || n > INT_MAX ||
+                    (hex < lf - 1 && *hex != ';' && *hex != ' ' && *hex != '\t'))
+            {
+                logerr("bad chunk size: %.*s\n", (int)(lf - 1 - p), p);
+                return NET_ERR;
             }
+
+            req->body_left = n;
+            req->chunk_state = n ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER;
         }
-        else if (req->parse_state == HTTP_PARSE_BODY)
-        {
-            logerr("not supported http parse state: %d\n", req->parse_state);
+        else if (req->chunk_state == HTTP_CHUNK_CRLF) {
+            if (lf != p + 1)
+            {
+                logerr("chunk data not ended with CRLF.\n");
+                return NET_ERR;
+            }
+            req->chunk_state = HTTP_CHUNK_SIZE;
         }
-        else {
-            logerr("unknown http parse state: %d\n", req->parse_state);
+        else if (lf == p + 1) {
+            // empty line ends the trailer, whose fields are dropped.
+            req->parse_state = HTTP_PARSE_DONE;
         }
+
+        p = lf + 1;
     }
 
-    return last;
+    return p - start;
+}
+
+
+// header strings point into @start[0, size) of inbuf, move them out so
+// the input can be consumed before the body has all arrived.
+int http_request_detach(http_request_t *req, char *start, int size)
+{
+    list_t *iter;
+    http_header_t *h;
+    char *head = malloc(size);
+
+    if (head == NULL)
+    {
+        logerr("request header alloc failed.\n");
+        return NET_ERR;
+    }
+    memcpy(head, start, size);
+
+    req->path = head + (req->path - start);
+    LIST_FOR_EACH(&req->headers, iter)
+    {
+        h = container_of(iter, http_header_t, node);
+        h->header_name = head + (h->header_name - start);
+        h->header_value = head + (h->header_value - start);
+    }
+    req->head = head;
+
+    return NET_OK;
+}
+
+
+// request header is parsed, find out what to do with its body.
+int http_request_header_done(http_request_t *req)
+{
+    const char *expect;
+    net_buf_t *buf;
+    net_connect_t *c = req->conn;
+
+    // answered with 400 without reading on, the connection closes.
+    if (http_request_framing(req) != NET_OK)
+    {
+        req->reject = 400;
+        return NET_OK;
+    }
+
+    req->handler = http_route_find(req->http_server->routes, req, &req->allow);
+
+    if (req->body_type == HTTP_BODY_NONE) return NET_OK;
+
+    // known to be too large, answered without reading it.
+    if (!req->on_body && req->body_type == HTTP_BODY_LENGTH &&
+            req->body_left > req->http_server->max_body)
+    {
+        req->reject = 413;
+        return NET_OK;
+    }
+
+    req->parse_state = HTTP_PARSE_BODY;
+
+    // the client waits for a go before it sends the body.
+    expect = http_find_header(&req->headers, "Expect");
+    if (expect && req->version == 1 && strcasecmp(expect, "100-continue") == 0)
+    {
+        buf = net_buf_alloc(c->loop, 0);
+        net_buf_append(buf, "HTTP/1.1 100 Continue\r\n\r\n");
+        net_connection_append(c, buf);
+        ((http_connection_t *)c->data)->unsent = 1;
+    }
+
+    return NET_OK;
+}
+
+
+// @req is answered, released once outbuf is flushed.
+void http_request_answered(http_request_t *req, http_connection_t *http_c)
+{
+    list_append(&http_c->pending, &req->node);
+    http_c->npending++;
+
+    // nothing after a "Connection: close" response is served.
+    if (http_res_keep_alive(req->res) == 0) http_c->closing = 1;
+}
+
+
+// outbuf drained to its low watermark, a stream that had to wait goes on.
+void http_stream_drained(net_connect_t *c, void *arg)
+{
+    http_connection_t *http_c = c->data;
+    http_response_t *res;
+
+    if (http_c == NULL || http_c->stream == NULL) return;
+
+    res = http_c->stream->res;
+    if (!res->blocked || res->writing) return;
+
+    res->blocked = 0;
+    if (res->on_write) res->on_write(res, res->write_data);
+}
+
+
+// header of a streamed response goes out ahead of its first piece.
+void http_res_stream_start(http_response_t *res)
+{
+    net_connect_t *c = res->conn;
+
+    res->streaming = 1;
+    res->chunked = res->req->version == 1;
+
+    // HTTP/1.0 has no chunks, the end of the body is the connection's.
+    if (res->chunked) http_res_add_header(res, "Transfer-Encoding", "chunked");
+
+    if (res->chunked && http_req_keep_alive(res->req))
+        http_res_add_header(res, "Connection", "keep-alive");
+    else
+        http_res_add_header(res, "Connection", "close");
+
+    net_connection_append(c, http_res_header(res));
+
+    if (c->high_watermark == 0)
+    {
+        net_connection_set_watermarks(c, NET_HIGH_WATERMARK, NET_LOW_WATERMARK);
+    }
+    net_connection_set_watermark_callback(c, NULL, http_stream_drained, NULL);
+}
+
+
+int http_res_flush(http_response_t *res)
+{
+    net_connect_t *c = res->conn;
+
+    // answers queued ahead go along.
+    ((http_connection_t *)c->data)->unsent = 0;
+
+    res->writing = 1;
+    net_connection_send(c);
+    res->writing = 0;
+
+    if (c->err) return NET_ERR;
+
+    if (c->above_watermark)
+    {
+        res->blocked = 1;
+        return NET_AGAIN;
+    }
+
+    return NET_OK;
+}
+
+
+/*
+ * Stream @len bytes of @data as part of the body of @res, the header goes
+ * out with the first call (also with @len 0), so it must be complete by
+ * then. Body and file set on @res are not sent, nor is @data for HEAD.
+ *
+ * return NET_AGAIN once too much output is pending: the data is queued,
+ * but the caller should stop and go on from its write callback. NET_ERR
+ * if the connection failed, see http_res_set_write_callback().
+ */
+int http_res_write(http_response_t *res, const char *data, int len)
+{
+    int n = 0;
+    net_buf_t *buf;
+    net_connect_t *c = res->conn;
+
+    if (res->aborted || res->ended || c->err) return NET_ERR;
+
+    if (!res->streaming) http_res_stream_start(res);
+
+    if (len > 0 && res->req->method != HTTP_HEAD)
+    {
+        // chunk size line and CRLF around data, a zero chunk ends it all.
+        buf = net_buf_alloc(c->loop, len + 16);
+        if (res->chunked) n = snprintf(buf->buf, buf->size, "%x\r\n", len);
+        buf->pos = n;
+        net_buf_copy(buf, (char *)data, len);
+        if (res->chunked) net_buf_copy(buf, "\r\n", 2);
+
+        net_connection_append(c, buf);
+    }
+
+    return http_res_flush(res);
+}
+
+
+/*
+ * @res has been written entirely, requests pipelined after it are served
+ * next. @res may be freed by this call.
+ */
+void http_res_end(http_response_t *res)
+{
+    net_buf_t *buf;
+    net_connect_t *c = res->conn;
+    http_connection_t *http_c = c->data;
+    http_request_t *req = res->req;
+
+    if (res->aborted || res->ended) return;
+
+    if (!res->streaming) http_res_stream_start(res);
+    res->ended = 1;
+
+    if (res->chunked && res->req->method != HTTP_HEAD)
+    {
+        buf = net_buf_alloc(c->loop, 0);
+        net_buf_append(buf, "0\r\n\r\n");
+        net_connection_append(c, buf);
+    }
+
+    // ended by its handler, http_request_process() takes it from here.
+    if (http_c->stream != req) return;
+
+    http_c->stream = NULL;
+    http_request_answered(req, http_c);
+    net_connection_send(c);
+
+    // requests received meanwhile.
+    if (http_c->throttled && http_c->npending < HTTP_PIPELINE_MAX)
+    {
+        http_c->throttled = 0;
+        net_connection_resume(c);
+    }
+    if (!c->processing && !c->err && c->inbuf->consume < c->inbuf->pos)
+    {
+        net_connection_process(c);
+    }
+}
+
+
+/* @cb(@res, @arg) runs once a write that returned NET_AGAIN is drained,
+ * and once more with res->aborted set if the connection closes before
+ * http_res_end(). @res is freed after that. */
+void http_res_set_write_callback(http_response_t *res,
+        http_write_handler cb, void *arg)
+{
+    res->on_write = cb;
+    res->write_data = arg;
 }
 
 
 void http_request_process(http_request_t *req, http_connection_t *http_c)
 {
     char len[22];
-    http_handler handler;
 
     http_response_t *res = http_response_init(req->conn);
-    http_c->res = res;
+    req->res = res;
+    res->req = req;
 
-    handler = http_dispatch_route(req->http_server, req);
-    if (handler)
+    if (req->reject == 400)
     {
-        handler(req, res);
+        http_res_set_status(res, 400, "Bad Request");
+    }
+    else if (req->reject) {
+        http_res_set_status(res, 413, "Payload Too Large");
+    }
+    else if (req->handler) {
+        req->handler(req, res);
+    }
+    else if (req->allow) {
+        http_res_set_status(res, 405, "Method Not Allowed");
+        http_res_add_header(res, "Allow", (char *)req->allow);
     }
     else {
         http_404_process(req, res);
         logerr("no matched route: %s\n", req->path);
     }
 
-    if (http_req_keep_alive(req))
+    if (res->streaming)
+    {
+        // the rest is written later, requests after it wait.
+        if (!res->ended) http_c->stream = req;
+        else http_request_answered(req, http_c);
+        return;
+    }
+
+    if (http_req_keep_alive(req) && !req->reject)
     {
         http_res_add_header(res, "Connection", "keep-alive");
         if (http_res_have_body(res))
         {
-            snprintf(len, sizeof(len), "%d", res->body->pos);
+            snprintf(len, sizeof(len), "%d", http_res_body_size(res));
             http_res_add_header(res, "Content-Length", len);
         }
         else {
@@ -484,62 +1094,148 @@ void http_request_process(http_request_t *req, http_connection_t *http_c)
     }
 
     http_send(res);
+    http_request_answered(req, http_c);
+}
+
+
+// answer @req, flush unless the next request is already buffered.
+void http_request_done(http_request_t *req, http_connection_t *http_c,
+        char *next, int size)
+{
+    http_c->req = NULL;
+    http_request_process(req, http_c);
+
+    // pipelined requests already buffered are answered in one write.
+    if (http_c->closing || http_c->npending >= HTTP_PIPELINE_MAX ||
+            !http_header_end(next, size))
+    {
+        http_c->unsent = 0;
+        net_connection_send(req->conn);
+    }
+    else {
+        http_c->unsent = 1;
+    }
 }
 
 
 // user-defined OnMessage callback.
 int net_request_process(char *start, size_t size, net_connect_t *c)
 {
-    http_server_t *s = (http_server_t *)c->data;
-    http_connection_t *http_c = NULL, *tmp_c;
+    http_connection_t *http_c = c->data;
     http_request_t *req;
-    list_t *iter;
-    char *last = start;
+    char *last, *head_end = NULL, *end = start + size;
+    int n, bad = 0;
 
     if (size <= 0) return NET_AGAIN;
+    if (!http_c) return NET_ERR;
+
+    // connection closes once answered, drop whatever follows.
+    if (http_c->closing) return size;
 
-    // match coresponding http-connection
-    LIST_FOR_EACH(&s->http_connections, iter)
+    // enough responses in flight, or one still streamed, stop reading
+    // until they're flushed.
+    if (http_c->npending >= HTTP_PIPELINE_MAX || http_c->stream)
     {
-        tmp_c = container_of(iter, http_connection_t, node);
-        if (tmp_c->fd == c->io_watcher.fd)
+        if (!http_c->throttled)
         {
-            http_c = tmp_c;
-            break;
+            http_c->throttled = 1;
+            net_connection_suspend(c);
         }
+        return 0;
     }
-    if (!http_c) return NET_ERR;
 
-    // create http req if not exist.
-    http_c->req = http_c->req ? http_c->req : http_request_init(s, c);
-    if(!http_c->req)
+    /* For HTTP parsing, we need ensure one null-terminated string. */
+    *(end) = '\0';
+
+    req = http_c->req;
+    if (req && req->parse_state == HTTP_PARSE_BODY)
     {
-        logerr("init request error\n");
-        return NET_ERR;
+        last = start;
     }
-    req = http_c->req;
+    else {
+        /* Parsed strings point into inbuf, which may move as it grows, so
+         * wait until the whole header is buffered before parsing it. */
+        if (!http_header_end(start, size))
+        {
+            if (!http_bare_lf(start, size)) return 0;
+            logerr("http line not ended with CRLF.\n");
+            bad = 1;
+        }
 
-    /* For HTTP parsing, we need ensure one null-terminated string. */
-    *(start + size) = '\0';
+        // create http req if not exist.
+        if (!http_c->req)
+            http_c->req = http_request_init(http_c->worker->http_server, c);
+        if(!http_c->req)
+        {
+            logerr("init request error\n");
+            return NET_ERR;
+        }
+        req = http_c->req;
 
-    last = http_request_parse(req, last, size);
+        last = bad ? NULL : http_request_parse(req, start, size);
 
-    if (!last) return NET_ERR;
+        // malformed, answered with 400 and the rest dropped.
+        if (!last)
+        {
+            req->reject = 400;
+            req->parse_state = HTTP_PARSE_DONE;
+            http_request_done(req, http_c, end, 0);
+            return size;
+        }
+        if (req->parse_state != HTTP_PARSE_DONE) return last - start;
 
-    if (req->parse_state == HTTP_PARSE_DONE)
-    {
-        http_request_process(req, http_c);
-        net_connection_send(c);
+        if (http_request_header_done(req) != NET_OK) return NET_ERR;
+        head_end = last;
     }
 
-    if (last >= start)
+    if (req->parse_state == HTTP_PARSE_BODY)
     {
-        return last - start;
+        n = http_request_body(req, last, end - last);
+        if (n < 0)
+        {
+            if (!req->reject) return NET_ERR;
+
+            // too large, answered right away and the rest dropped.
+            req->parse_state = HTTP_PARSE_DONE;
+            n = end - last;
+        }
+        last += n;
+
+        if (req->parse_state == HTTP_PARSE_BODY)
+        {
+            // what's parsed of the request leaves inbuf, it's consumed.
+            if (head_end &&
+                    http_request_detach(req, start, head_end - start) != NET_OK)
+            {
+                return NET_ERR;
+            }
+            if (http_body_keep(req) != NET_OK) return NET_ERR;
+
+            // answers queued before, or 100 Continue, mustn't wait for it.
+            if (http_c->unsent)
+            {
+                http_c->unsent = 0;
+                net_connection_send(c);
+            }
+
+            return last - start;
+        }
     }
-    else {
-        logerr("error parse http.\n");
-        return NET_ERR;
+
+    http_request_done(req, http_c, last, end - last);
+
+    // streamed on after this returns, when inbuf is reused.
+    if (http_c->stream == req)
+    {
+        if (head_end &&
+                http_request_detach(req, start, head_end - start) != NET_OK)
+        {
+            return NET_ERR;
+        }
+        if (http_body_keep(req) != NET_OK) return NET_ERR;
     }
+
+    return last - start;
 }
 
 
@@ -550,44 +1246,77 @@ void net_request_error(const char *err_msg)
 }
 
 
-http_server_t *http_server_init(char *host, int port)
+/* @workers: number of loops (threads) serving @port, <= 0 means one per cpu.
+ * Every loop owns its listening socket, the kernel spreads connections
+ * among them through SO_REUSEPORT. */
+http_server_t *http_server_init(char *host, int port, int workers)
 {
-    net_loop_t *loop;
+    int i;
+    net_loop_group_t *group;
     net_server_t *tcp_server;
     http_server_t *http_server;
+    http_worker_t *w;
 
-    loop = net_loop_init(EPOLL_SIZE);
-    if (!loop)
+    group = net_loop_group_init(workers, EPOLL_SIZE);
+    if (!group)
     {
         logerr("init loop failed.\n");
         exit(EXIT_FAILURE);
     }
 
-    tcp_server = net_server_init(loop, host, port);
-    if (!tcp_server)
+    http_server = calloc(1, sizeof(http_server_t));
+    http_server->routes = http_route_init();
+    http_server->max_body = HTTP_BODY_MAX;
+    http_server->group = group;
+    http_server->nworkers = group->nloops;
+    http_server->workers = calloc(group->nloops, sizeof(http_worker_t));
+
+    for (i = 0; i < group->nloops; i++)
     {
-        logerr("init server failed.\n");
-        exit(EXIT_FAILURE);
-    }
+        tcp_server = net_server_init(group->loops[i], host, port);
+        if (!tcp_server)
+        {
+            logerr("init server failed.\n");
+            exit(EXIT_FAILURE);
+        }
 
-    http_server = calloc(1, sizeof(http_server_t));
-    list_init(&http_server->routes);
-    list_init(&http_server->http_connections);
-    http_server->tcp_server = tcp_server;
+        w = &http_server->workers[i];
+        w->tcp_server = tcp_server;
+        w->http_server = http_server;
 
-    net_server_set_accept_callback(tcp_server, http_accept_cb, http_server);
-    net_server_set_close_callback(tcp_server, http_close_cb, http_server);
-    net_server_set_message_callback(tcp_server, net_request_process);
-    net_server_set_done_callback(tcp_server, http_done_cb, http_server);
-    net_server_set_error_callback(tcp_server, net_request_error);
+        net_server_set_accept_callback(tcp_server, http_accept_cb, w);
+        net_server_set_close_callback(tcp_server, http_close_cb, w);
+        net_server_set_message_callback(tcp_server, net_request_process);
+        net_server_set_done_callback(tcp_server, http_done_cb, w);
+        net_server_set_error_callback(tcp_server, net_request_error);
+    }
 
     return http_server;
 }
 
 
-void http_server_start(http_server_t *s)
+// deadlines for client connections on every worker, see net_timeouts_t.
+void http_server_set_timeouts(http_server_t *s, net_timeouts_t *to)
+{
+    int i;
+
+    for (i = 0; i < s->nworkers; i++)
+    {
+        net_server_set_timeouts(s->workers[i].tcp_server, to);
+    }
+}
+
+
+// longer bodies are answered with 413, unless their route streams them.
+void http_server_set_max_body(http_server_t *s, long size)
 {
-    net_loop_start(s->tcp_server->loop);
+    s->max_body = size;
 }
 
 
+// returns once every worker stopped, the loop group is gone by then.
+void http_server_start(http_server_t *s)
+{
+    net_loop_group_start(s->group);
+    s->group = NULL;
+}
@@ -8,20 +8,65 @@ typedef  struct http_request_t http_request_t;
 typedef struct http_header_t http_header_t;
 typedef struct http_response_t http_response_t;
 typedef struct http_route_t http_route_t;
+typedef struct http_param_t http_param_t;
 typedef struct http_server_t http_server_t;
 typedef struct http_connection_t http_connection_t;
+typedef struct http_worker_t http_worker_t;
 
 #define HTTP_GET 0
 #define HTTP_POST 1
 #define HTTP_HEAD 2
+#define HTTP_PUT 3
+#define HTTP_DELETE 4
+#define HTTP_OPTIONS 5
+#define HTTP_PATCH 6
+#define HTTP_CONNECT 7
+#define HTTP_TRACE 8
+
+// route for every method, see http_add_route_method()
+#define HTTP_ANY 9
+
+// request headers stored inline, more are allocated
+#define HTTP_HEADER_SLOTS 16
+
+// parameters a single route may hold, see http_req_param()
+#define HTTP_ROUTE_PARAMS 8
+
+// pipelined requests answered ahead of what's been flushed
+#define HTTP_PIPELINE_MAX 16
 
 #define HTTP_PARSE_REQ_LINE 0
 #define HTTP_PARSE_HEADER 1
 #define HTTP_PARSE_BODY 2
 #define HTTP_PARSE_DONE 3
 
+// request body framing
+#define HTTP_BODY_NONE 0
+#define HTTP_BODY_LENGTH 1
+#define HTTP_BODY_CHUNKED 2
+
+// chunked body decoder
+#define HTTP_CHUNK_SIZE 0
+#define HTTP_CHUNK_DATA 1
+#define HTTP_CHUNK_CRLF 2
+#define HTTP_CHUNK_TRAILER 3
+
+// longest chunk size or trailer line
+#define HTTP_CHUNK_LINE_MAX 1024
+
+// buffered request bodies, see http_server_set_max_body()
+#define HTTP_BODY_MAX (1024 * 1024)
+
 typedef void(*http_handler)(http_request_t *, http_response_t *);
 
+/* Takes a request body piece by piece, see http_add_body_route().
+ * Called with NULL once if the request is aborted before its end,
+ * returning NET_ERR drops the connection. */
+typedef int (*http_body_handler)(http_request_t *, char *, int);
+
+// a streamed response may take more, see http_res_write().
+typedef void (*http_write_handler)(http_response_t *, void *);
+
 struct http_header_t
 {
     list_t node;
@@ -30,16 +75,65 @@ struct http_header_t
 };
 
 
+struct http_param_t
+{
+    const char *name;
+    char *value;
+};
+
+
 struct http_request_t
 {
+    // http_connection_t.pending
+    list_t node;
+
     int method;
     int version;
     char *path;
     list_t headers;
+
+    // names and values point into inbuf
+    http_header_t header_slots[HTTP_HEADER_SLOTS];
+    int nheaders;
+
+    // data and parameters of the matched route
+    void *route_data;
+    http_param_t params[HTTP_ROUTE_PARAMS];
+    int nparams;
+    char *params_buf;
+
+    // handler found once the header is parsed, 405 if only allow is
+    http_handler handler;
+    http_body_handler on_body;
+    const char *allow;
+
+    // body, left out when it's given to on_body. not NUL-terminated,
+    // it points into inbuf, or body_buf when it spans several reads.
+    char *body;
+    long body_size;
+    net_buf_t *body_buf;
+
+    // decoder state, body_left is what remains of the body or chunk
+    int body_type;
+    int chunk_state;
+    long body_left;
+
+    // header block once copied out of inbuf, see http_request_detach()
+    char *head;
+
+    // free for handlers, e.g. what a streamed body is written to
+    void *data;
+
+    // answered with this status instead of routed, then closed
+    int reject;
+
     int error;
     int parse_state;
     net_connect_t *conn;
     http_server_t *http_server;
+
+    // set once answered
+    http_response_t *res;
 };
 
 
@@ -52,42 +146,98 @@ struct http_response_t
     net_buf_t *body;
     int body_size;
 
-    net_connect_t *conn;
-};
+    // file segment sent after body, see http_res_set_file()
+    net_buf_t *file;
 
+    // body streamed by http_res_write(), chunked unless for HTTP/1.0
+    int streaming;
+    int chunked;
+    int ended;
 
-struct http_route_t
-{
-    list_t node;
+    // last write asked to wait (blocked), on_write runs once drained.
+    // aborted if the connection closed before http_res_end().
+    int blocked;
+    int writing;
+    int aborted;
+    http_write_handler on_write;
+    void *write_data;
 
-    char *url_path;
-    http_handler url_handler;
+    net_connect_t *conn;
+    http_request_t *req;
 };
 
 
+// kept in net_connect_t.data of every client connection
 struct http_connection_t
 {
-    list_t node;
+    http_worker_t *worker;
 
-    int fd;
+    // being parsed
     http_request_t *req;
-    http_response_t *res;
+
+    // answered, oldest first, until their responses are flushed.
+    // reading is suspended (throttled) while HTTP_PIPELINE_MAX are.
+    list_t pending;
+    int npending;
+    int throttled;
+
+    // answered, but not handed to net_connection_send() yet
+    int unsent;
+
+    // a response said "Connection: close"
+    int closing;
+
+    // answer still streamed, requests after it wait until it ends
+    http_request_t *stream;
+};
+
+
+// per-loop state, only touched by the thread running that loop.
+struct http_worker_t
+{
+    net_server_t *tcp_server;
+    http_server_t *http_server;
 };
 
 
 struct http_server_t
 {
-    list_t routes;
-    list_t http_connections;
+    // see route.h
+    http_route_t *routes;
 
-    net_server_t *tcp_server;
+    // longest body buffered for a handler
+    long max_body;
+
+    int nworkers;
+    http_worker_t *workers;
+    net_loop_group_t *group;
 };
 
-http_server_t *http_server_init(char *, int);
+http_server_t *http_server_init(char *, int, int);
 void http_server_start(http_server_t *);
+void http_server_set_timeouts(http_server_t *, net_timeouts_t *);
+void http_server_set_max_body(http_server_t *, long);
 void http_add_route(http_server_t *, char *, http_handler);
+void http_add_route_data(http_server_t *, char *, http_handler, void *);
+void http_add_route_method(http_server_t *, int, char *, http_handler, void *);
+void http_add_body_route(http_server_t *, int, char *, http_body_handler,
+        http_handler, void *);
+const char *http_req_param(http_request_t *, const char *);
+const char *http_method_name(int);
+const char *http_find_header(list_t *, const char *);
 void http_res_set_status(http_response_t *, int, char *);
 void http_res_add_header(http_response_t *, char *, char *);
 void http_res_set_body(http_response_t *, net_buf_t *);
+int  http_res_set_file(http_response_t *, int, off_t, int);
+void http_res_set_file_buf(http_response_t *, net_buf_t *);
+int  http_res_write(http_response_t *, const char *, int);
+void http_res_end(http_response_t *);
+void http_res_set_write_callback(http_response_t *, http_write_handler, void *);
+
+// request parser
+http_request_t *http_request_init(http_server_t *, net_connect_t *);
+char *http_request_parse(http_request_t *, char *, int);
+char *http_header_end(char *, int);
+void http_request_free(http_request_t *);
 
 #endif // _HTTP_H_
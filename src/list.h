@@ -61,4 +61,17 @@ static inline void list_del(list_t *n)
     n->prev = n;
 }
 
+// move all nodes of @from to the tail of @l, leaving @from empty.
+static inline void list_splice(list_t *l, list_t *from)
+{
+    if (list_empty(from)) return;
+
+    from->next->prev = l->prev;
+    l->prev->next = from->next;
+    from->prev->next = l;
+    l->prev = from->prev;
+
+    list_init(from);
+}
+
 #endif  // _LIST_H_
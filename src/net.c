@@ -1,8 +1,13 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
 #include <strings.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -13,15 +18,20 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "net.h"
+#include "uring.h"
+#include "wheel.h"
+#include "pipe.h"
 #include "util.h"
 
-int net_buf_full(net_buf_t *b)
-{
-    return b->pos == b->size;
-}
+// engine used by net_loop_init(), see net_loop_engine().
+int loop_engine = NET_ENGINE_DEFAULT;
 
+const int net_pool_sizes[NET_POOL_CLASSES] = {512, 4096, 16384, 65536};
 
 void net_buf_reset(net_buf_t *buf)
 {
@@ -53,6 +63,108 @@ net_buf_t *net_buf_create(size_t size)
     }
 
     buf->buf = malloc(buf->size);
+    buf->pool = NULL;
+    net_buf_reset(buf);
+    list_init(&buf->node);
+
+    return buf;
+}
+
+
+// smallest size class holding @size, -1 if beyond the largest one.
+int net_pool_class(size_t size)
+{
+    int i;
+
+    for (i = 0; i < NET_POOL_CLASSES; i++)
+    {
+        if (size <= net_pool_sizes[i]) return i;
+    }
+
+    return -1;
+}
+
+
+char *net_pool_chunk_get(net_buf_pool_t *p, int cls, int *hit)
+{
+    list_t *chunk;
+
+    if (list_empty(&p->chunks[cls]))
+    {
+        *hit = 0;
+        return malloc(net_pool_sizes[cls]);
+    }
+
+    // free chunks are linked through their first bytes.
+    chunk = p->chunks[cls].next;
+    list_del(chunk);
+    p->nchunks[cls]--;
+
+    return (char *)chunk;
+}
+
+
+void net_pool_chunk_put(net_buf_pool_t *p, char *chunk, int size)
+{
+    list_t *node = (list_t *)chunk;
+    int cls = net_pool_class(size);
+
+    if (cls < 0 || net_pool_sizes[cls] != size ||
+            (p->nchunks[cls] + 1) * size > NET_POOL_CLASS_BYTES)
+    {
+        free(chunk);
+        return;
+    }
+
+    list_init(node);
+    list_add(&p->chunks[cls], node);
+    p->nchunks[cls]++;
+}
+
+
+net_buf_t *net_buf_pool_get(net_buf_pool_t *p, size_t size)
+{
+    int cls, hit = 1;
+    list_t *node;
+    net_buf_t *buf;
+
+    if (list_empty(&p->bufs))
+    {
+        buf = malloc(sizeof(net_buf_t));
+        hit = 0;
+    }
+    else {
+        node = p->bufs.next;
+        list_del(node);
+        p->nbufs--;
+        buf = container_of(node, net_buf_t, node);
+    }
+
+    if (size)
+    {
+        buf->auto_scale = 0;
+    }
+    else {
+        size = NET_BUF_SIZE;
+        buf->auto_scale = 1;
+    }
+
+    cls = net_pool_class(size);
+    if (cls >= 0)
+    {
+        buf->size = net_pool_sizes[cls];
+        buf->buf = net_pool_chunk_get(p, cls, &hit);
+    }
+    else {
+        buf->size = size;
+        buf->buf = malloc(size);
+        hit = 0;
+    }
+
+    if (hit) p->hits++;
+    else p->misses++;
+
+    buf->pool = p;
     net_buf_reset(buf);
     list_init(&buf->node);
 
@@ -60,12 +172,82 @@ net_buf_t *net_buf_create(size_t size)
 }
 
 
+/* same as net_buf_create(), but recycled through @loop's pool,
+ * capacity is rounded up to the size class. */
+net_buf_t *net_buf_alloc(net_loop_t *loop, size_t size)
+{
+    return net_buf_pool_get(&loop->buf_pool, size);
+}
+
+
+/* allocations @loop's pool served from cache / had to malloc, read them
+ * on the loop's thread (a task, the stop callback) for exact numbers. */
+void net_loop_buf_stats(net_loop_t *loop, unsigned long *hits,
+        unsigned long *misses)
+{
+    if (hits) *hits = loop->buf_pool.hits;
+    if (misses) *misses = loop->buf_pool.misses;
+}
+
+
+void net_buf_pool_init(net_buf_pool_t *p)
+{
+    int i;
+
+    memset(p, 0, sizeof(net_buf_pool_t));
+    list_init(&p->bufs);
+    for (i = 0; i < NET_POOL_CLASSES; i++) list_init(&p->chunks[i]);
+}
+
+
+void net_buf_pool_destroy(net_buf_pool_t *p)
+{
+    int i;
+    list_t *node, *node_next;
+
+    logdebug("buf pool hits: %lu, misses: %lu\n", p->hits, p->misses);
+
+    LIST_FOR_EACH_SAFE(&p->bufs, node, node_next)
+    {
+        free(container_of(node, net_buf_t, node));
+    }
+
+    for (i = 0; i < NET_POOL_CLASSES; i++)
+    {
+        LIST_FOR_EACH_SAFE(&p->chunks[i], node, node_next)
+        {
+            free(node);
+        }
+    }
+
+    net_buf_pool_init(p);
+}
+
+
 void net_buf_scale(net_buf_t *buf, int diff)
 {
-    char *new_buf = malloc(buf->size + 2*diff);
+    int cls, hit = 1;
+    int size = buf->size + 2*diff;
+    char *new_buf;
+
+    cls = net_pool_class(size);
+    if (buf->pool && cls >= 0)
+    {
+        size = net_pool_sizes[cls];
+        new_buf = net_pool_chunk_get(buf->pool, cls, &hit);
+        if (hit) buf->pool->hits++;
+        else buf->pool->misses++;
+    }
+    else {
+        new_buf = malloc(size);
+    }
+
     memcpy(new_buf, buf->buf, buf->pos);
-    buf->size += 2*diff;
-    free(buf->buf);
+
+    if (buf->pool) net_pool_chunk_put(buf->pool, buf->buf, buf->size);
+    else free(buf->buf);
+
+    buf->size = size;
     buf->buf = new_buf;
 }
 
@@ -113,30 +295,105 @@ void net_buf_append(net_buf_t *buf, const char *fmt, ...)
 
 void net_buf_del(net_buf_t *buf)
 {
-    free(buf->buf);
+    net_buf_pool_t *p = buf->pool;
+
     list_del(&buf->node);
-    free(buf);
+
+    if (net_buf_is_file(buf))
+    {
+        if (buf->file_done) buf->file_done(buf->file_data);
+        else close(buf->file_fd);
+        free(buf);
+        return;
+    }
+
+    if (p == NULL)
+    {
+        free(buf->buf);
+        free(buf);
+        return;
+    }
+
+    net_pool_chunk_put(p, buf->buf, buf->size);
+
+    if (p->nbufs < NET_POOL_MAX_BUFS)
+    {
+        list_add(&p->bufs, &buf->node);
+        p->nbufs++;
+    }
+    else {
+        free(buf);
+    }
+}
+
+
+// segment sending @len bytes of @fd from @offset, @fd is closed once
+// it's done unless file_done is set.
+net_buf_t *net_buf_file(int fd, off_t offset, int len)
+{
+    net_buf_t *buf = calloc(1, sizeof(net_buf_t));
+
+    if (buf == NULL) return NULL;
+
+    buf->file_fd = fd;
+    buf->file_off = offset;
+    buf->size = len;
+    buf->pos = len;
+    list_init(&buf->node);
+
+    return buf;
 }
 
 
-net_buf_t *net_buf_realloc(net_buf_t *old)
+// push file segment @b to @c, returns bytes sent like write().
+ssize_t net_buf_sendfile(net_connect_t *c, net_buf_t *b)
 {
-    int len;
-    net_buf_t *new;
+    ssize_t n;
+    off_t off = b->file_off + b->consume;
 
-    len = old->pos - old->consume;
-    if (len == 0)
+    n = sendfile(c->io_watcher.fd, b->file_fd, &off, b->pos - b->consume);
+    if (n == 0)
     {
-        net_buf_reset(old);
-        return old;
+        // file shrank under us, the promised length can't be met.
+        errno = EIO;
+        return -1;
     }
 
-    new = net_buf_create(old->size);
-    memcpy(new->buf, old->buf + old->consume, len);
-    new->pos += len;
+    return n;
+}
+
+
+/*
+ * make room for @want more bytes after pos, growing up to @max. Nothing
+ * moves while the tail already has room, otherwise unread data is first
+ * moved to the front and the buffer grown if that is still short. One
+ * byte past the data is kept spare, parsers may NUL-terminate what they
+ * are given.
+ *
+ * return room left, less than @want once @max is reached and 0 when
+ * unread data fills all of @max.
+ */
+int net_buf_reserve(net_buf_t *buf, int want, int max)
+{
+    int len = buf->pos - buf->consume;
+    int size = buf->size;
 
-    net_buf_del(old);
-    return new;
+    if (len == 0) net_buf_reset(buf);
+    if (buf->size - buf->pos - 1 >= want) return buf->size - buf->pos - 1;
+
+    if (buf->consume > 0)
+    {
+        memmove(buf->buf, buf->buf + buf->consume, len);
+        buf->pos = len;
+        buf->consume = 0;
+        buf->req_cnt = 0;
+    }
+
+    while (size - len - 1 < want && size < max) size *= 2;
+    if (size > max) size = max;
+    if (size > buf->size) net_buf_scale(buf, (size - buf->size + 1) / 2);
+
+    return buf->size - buf->pos - 1;
 }
 
 
@@ -146,19 +403,13 @@ int net_listen(char *host, int port)
     int sock_fd;
     struct sockaddr_in addr;
 
-    sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sock_fd < 0)
     {
         logerr("socket failed: %s\n", strerror(errno));
         return -1;
     }
 
-    if (setnoblock(sock_fd))
-    {
-        logerr("[%s] set non-block failed: %s\n", __func__, strerror(errno));
-        return -1;
-    }
-
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = inet_addr(host);
@@ -185,7 +436,7 @@ int net_listen(char *host, int port)
         return -1;
     }
 
-    if (listen(sock_fd, 100))
+    if (listen(sock_fd, NET_LISTEN_BACKLOG))
     {
         logerr("listen failed: %s\n", strerror(errno));
         close(sock_fd);
@@ -261,15 +512,24 @@ void net_io_start(net_loop_t *loop, net_io_t *w, enum event_type type)
     {
         if (w->reading) return;
         ee.events |= (EPOLLIN | EPOLLRDHUP);
+        if (w->writing) ee.events |= EPOLLOUT;
         w->reading = 1;
     }
     else if (type == NET_EV_WRITE)
     {
         if (w->writing) return;
         ee.events |= EPOLLOUT;
+        if (w->reading) ee.events |= (EPOLLIN | EPOLLRDHUP);
         w->writing = 1;
     }
 
+    if (loop->engine == NET_ENGINE_URING)
+    {
+        w->alive = 1;
+        net_uring_poll_update(loop, w);
+        return;
+    }
+
     ee.events |= EPOLLET;
     ee.data.ptr = w;
 
@@ -318,12 +578,25 @@ void net_io_stop(net_loop_t *loop, net_io_t *w, enum event_type type)
     {
         eep = NULL;
         op = EPOLL_CTL_DEL;
+
+        if (w->posted)
+        {
+            list_del(&w->node);
+            w->posted = 0;
+        }
     }
     else {
         logerr("unknown event type: %d\n", type);
         return;
     }
 
+    if (loop->engine == NET_ENGINE_URING)
+    {
+        if (type == NET_EV_ALL) net_uring_forget(loop, w);
+        else net_uring_poll_update(loop, w);
+        return;
+    }
+
     if ((epoll_ctl(loop->epfd, op, w->fd, eep)) == -1)
     {
         logerr("%s: epoll_ctl failed: %s\n", __func__, strerror(errno));
@@ -331,28 +604,250 @@ void net_io_stop(net_loop_t *loop, net_io_t *w, enum event_type type)
 }
 
 
+// run @w->cb once more after this round of events, with @w->events kept.
 void net_io_post(net_loop_t *loop, net_io_t *w)
 {
+    if (w->posted) return;
+
+    w->posted = 1;
     list_append(&loop->postpone_events, &w->node);
 }
 
 
+// index @c by @fd in @loop's connection table, NULL clears the slot.
+void net_connection_register(net_loop_t *loop, int fd, net_connect_t *c)
+{
+    int size;
+    net_connect_t **conns;
+
+    if (fd < 0) return;
+
+    if (fd >= loop->conns_size)
+    {
+        if (c == NULL) return;
+
+        size = loop->conns_size ? loop->conns_size : 1024;
+        while (size <= fd) size *= 2;
+
+        conns = realloc(loop->conns, size * sizeof(net_connect_t *));
+        if (conns == NULL)
+        {
+            logerr("connection table realloc failed.\n");
+            return;
+        }
+        memset(conns + loop->conns_size, 0,
+                (size - loop->conns_size) * sizeof(net_connect_t *));
+
+        loop->conns = conns;
+        loop->conns_size = size;
+    }
+
+    loop->conns[fd] = c;
+}
+
+
+// open connection of @loop on @fd, NULL if there's none.
+net_connect_t *net_connection_find(net_loop_t *loop, int fd)
+{
+    if (fd < 0 || fd >= loop->conns_size) return NULL;
+    return loop->conns[fd];
+}
+
+
+// give @c back to its loop, zeroed for the next net_connection_new().
+// events of @c may still wait in evlist, it's only parked until they're gone.
+void net_connection_free(net_connect_t *c)
+{
+    net_loop_t *loop = c->loop;
+
+    memset(c, 0, sizeof(net_connect_t));
+    list_add(&loop->closed_conns, &c->node);
+    loop->nfree_conns++;
+}
+
+
+// once evlist is dispatched, closed connections may be reused or freed.
+void net_connection_recycle(net_loop_t *loop)
+{
+    net_connect_t *c;
+
+    list_splice(&loop->free_conns, &loop->closed_conns);
+
+    while (loop->nfree_conns > NET_CONN_CACHE)
+    {
+        c = container_of(loop->free_conns.prev, net_connect_t, node);
+        list_del(&c->node);
+        loop->nfree_conns--;
+        free(c);
+    }
+}
+
+
 net_connect_t * net_connection_new(net_loop_t *loop, int fd)
 {
-    net_connect_t *c = calloc(1, sizeof(net_connect_t));
+    net_connect_t *c;
+
+    if (!list_empty(&loop->free_conns))
+    {
+        c = container_of(loop->free_conns.next, net_connect_t, node);
+        list_del(&c->node);
+        loop->nfree_conns--;
+    }
+    else {
+        c = calloc(1, sizeof(net_connect_t));
+        if (c == NULL)
+        {
+            logerr("connection calloc failed.\n");
+            return NULL;
+        }
+    }
 
     c->loop = loop;
-    c->inbuf = net_buf_create(REQ_SIZE);
+    c->inbuf = net_buf_alloc(loop, REQ_SIZE);
+    c->max_inbuf = NET_INBUF_MAX;
+    c->read_budget = NET_READ_BUDGET;
     list_init(&c->outbuf);
     list_init(&c->node);
+    net_timer_prepare(&c->timeout_timer, loop);
+    c->pipe_fds[0] = c->pipe_fds[1] = -1;
+
+    net_connection_register(loop, fd, c);
 
     return c;
 }
 
 
+// arm READ, io_uring loops receive through multishot recv instead.
+void net_connection_read_start(net_connect_t *c)
+{
+    if (c->loop->engine == NET_ENGINE_URING)
+        net_uring_recv_start(c);
+    else
+        net_io_start(c->loop, &c->io_watcher, NET_EV_READ);
+}
+
+
 void net_connection_suspend(net_connect_t *c)
 {
-    net_io_stop(c->loop, &c->io_watcher, NET_EV_READ);
+    if (c->loop->engine == NET_ENGINE_URING)
+        net_uring_recv_stop(c);
+    else
+        net_io_stop(c->loop, &c->io_watcher, NET_EV_READ);
+}
+
+
+// re-arm READ after net_connection_suspend(), edge-triggered epoll
+// reports data that arrived meanwhile on re-arm.
+void net_connection_resume(net_connect_t *c)
+{
+    if (c->err) return;
+    net_connection_read_start(c);
+}
+
+
+// @high 0 disables, @low defaults to a quarter of @high.
+void net_connection_set_watermarks(net_connect_t *c, size_t high, size_t low)
+{
+    if (low == 0 || low >= high) low = high / 4;
+
+    c->high_watermark = high;
+    c->low_watermark = low;
+    c->above_watermark = 0;
+}
+
+
+void net_connection_set_watermark_callback(net_connect_t *c,
+        watermark_handler on_high, watermark_handler on_low, void *arg)
+{
+    c->on_high_watermark = on_high;
+    c->on_low_watermark = on_low;
+    c->watermark_data = arg;
+}
+
+
+// suspend reading @source while @sink has too much output pending,
+// resume it once @sink drained to its low watermark.
+void net_connection_throttle(net_connect_t *sink, net_connect_t *source)
+{
+    if (sink->high_watermark == 0)
+    {
+        net_connection_set_watermarks(sink,
+                NET_HIGH_WATERMARK, NET_LOW_WATERMARK);
+    }
+
+    sink->throttle_source = source;
+    source->throttle_sink = sink;
+}
+
+
+// queue @buf on @c's outbuf, it goes out with net_connection_send().
+void net_connection_append(net_connect_t *c, net_buf_t *buf)
+{
+    list_append(&c->outbuf, &buf->node);
+    c->out_bytes += buf->pos - buf->consume;
+}
+
+
+// @c->out_bytes changed, fire callbacks when it crosses a watermark.
+void net_connection_watermark(net_connect_t *c)
+{
+    net_connect_t *source = c->throttle_source;
+
+    if (c->above_watermark == 0 && c->out_bytes >= c->high_watermark)
+    {
+        logdebug("[conn: %p, fd: %d] outbuf above high watermark: %zu\n",
+                c, c->io_watcher.fd, c->out_bytes);
+        c->above_watermark = 1;
+
+        if (source && !source->throttled)
+        {
+            source->throttled = 1;
+            net_connection_suspend(source);
+        }
+        if (c->on_high_watermark)
+        {
+            (c->on_high_watermark)(c, c->watermark_data);
+        }
+    }
+    else if (c->above_watermark && c->out_bytes <= c->low_watermark) {
+        logdebug("[conn: %p, fd: %d] outbuf below low watermark: %zu\n",
+                c, c->io_watcher.fd, c->out_bytes);
+        c->above_watermark = 0;
+
+        if (source && source->throttled)
+        {
+            source->throttled = 0;
+            net_connection_resume(source);
+        }
+        if (c->on_low_watermark)
+        {
+            (c->on_low_watermark)(c, c->watermark_data);
+        }
+    }
+}
+
+
+// @n bytes of outbuf have been sent.
+void net_connection_sent(net_connect_t *c, size_t n)
+{
+    c->out_bytes = n < c->out_bytes ? c->out_bytes - n : 0;
+    if (c->high_watermark) net_connection_watermark(c);
+}
+
+
+// discard input queued on @c's socket, up to NET_READ_BUDGET bytes.
+void net_connection_drain(net_connect_t *c)
+{
+    char buf[4096];
+    ssize_t n;
+    int left = NET_READ_BUDGET;
+
+    while (left > 0)
+    {
+        n = recv(c->io_watcher.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n <= 0) break;
+        left -= n;
+    }
 }
 
 
@@ -368,10 +863,30 @@ void net_connection_close(net_connect_t *c)
 
     // del fd from epoll
     net_io_stop(c->loop, &c->io_watcher, NET_EV_ALL);
+    net_timer_stop(&c->timeout_timer);
+
+    // break throttle links, whoever we held back reads again.
+    if (c->throttle_sink) c->throttle_sink->throttle_source = NULL;
+    if (c->throttle_source)
+    {
+        c->throttle_source->throttle_sink = NULL;
+        if (c->throttle_source->throttled)
+        {
+            c->throttle_source->throttled = 0;
+            net_connection_resume(c->throttle_source);
+        }
+    }
+
+    // stop relaying in both directions.
+    net_pipe_release(c);
+    if (c->pipe_source) net_pipe_release(c->pipe_source);
 
     // free input buf
     net_buf_del(c->inbuf);
 
+    // output buf still referenced by in-flight sends
+    if (c->loop->engine == NET_ENGINE_URING) net_uring_bury(c);
+
     // free output buf
     LIST_FOR_EACH_SAFE(&c->outbuf, node, node_next)
     {
@@ -395,14 +910,25 @@ void net_connection_close(net_connect_t *c)
         free(c->client);
     }
 
+    // closing with unread input sends RST, which may discard our last
+    // reply before the peer reads it. take what's queued first.
+    if (c->closing && !c->err && !c->peer_close)
+    {
+        net_connection_drain(c);
+    }
+
     // shutdown peer connection
+    if (net_connection_find(c->loop, c->io_watcher.fd) == c)
+    {
+        net_connection_register(c->loop, c->io_watcher.fd, NULL);
+    }
     close(c->io_watcher.fd);
 
     // del from server->conn_list
     list_del(&c->node);
 
-    // free conn
-    free(c);
+    // free conn, or let the last pool job do it.
+    if (c->jobs == 0) net_connection_free(c);
 }
 
 
@@ -423,6 +949,108 @@ void net_connection_error(net_connect_t *conn, const char *err_msg)
 }
 
 
+// @since + @ms has passed? otherwise fold that deadline into @next.
+int net_deadline_passed(uint64_t since, int ms, uint64_t now, uint64_t *next)
+{
+    if (ms <= 0 || since == 0) return 0;
+    if (now >= since + ms) return 1;
+    if (since + ms < *next) *next = since + ms;
+    return 0;
+}
+
+
+/* Which deadline of @c has passed at @now, NULL if none. Otherwise @next
+ * is set to the earliest moment one of them may expire. */
+const char *net_connection_deadline(net_connect_t *c, uint64_t now,
+        uint64_t *next)
+{
+    int pending, check = 0;
+    net_timeouts_t *to = &c->timeouts;
+
+    pending = c->connecting || !list_empty(&c->outbuf);
+    *next = UINT64_MAX;
+
+    if (net_deadline_passed(c->created, to->lifetime, now, next))
+        return "lifetime exceeded";
+    if (pending && net_deadline_passed(c->last_write, to->write, now, next))
+        return "write timeout";
+    if (!pending && net_deadline_passed(c->msg_since, to->read, now, next))
+        return "read timeout";
+    if (net_deadline_passed(c->last_active, to->idle, now, next))
+        return "idle timeout";
+
+    // deadlines not started yet can't expire before the shortest one.
+    if (to->idle > 0) check = to->idle;
+    if (to->read > 0 && (!check || to->read < check)) check = to->read;
+    if (to->write > 0 && (!check || to->write < check)) check = to->write;
+    if (check && *next > now + check) *next = now + check;
+
+    return NULL;
+}
+
+
+/* Deadlines are not re-armed on every read or write, the timer just
+ * wakes up at the earliest one it knows of, closes @c if it's really
+ * overdue or goes back to sleep until the next one. */
+void net_connection_on_timeout(net_timer_t *t)
+{
+    uint64_t now = net_time_ms(), next;
+    const char *reason;
+    net_connect_t *c = net_timer_data(t);
+
+    reason = net_connection_deadline(c, now, &next);
+    if (reason)
+    {
+        logdebug("[conn: %p, fd: %d] %s, closing connection.\n",
+                c, c->io_watcher.fd, reason);
+        net_connection_error(c, reason);
+        net_connection_close(c);
+        return;
+    }
+
+    net_timer_reset_ms(t, next - now, 0);
+}
+
+
+// override deadlines inherited from server/client, all 0 disables them.
+void net_connection_set_timeouts(net_connect_t *c, net_timeouts_t *to)
+{
+    uint64_t now, next;
+    net_timer_t *t = &c->timeout_timer;
+
+    c->timeouts = *to;
+    net_timer_stop(t);
+
+    if (to->idle <= 0 && to->read <= 0 &&
+            to->write <= 0 && to->lifetime <= 0)
+    {
+        t->timer_cb = NULL;
+        return;
+    }
+
+    now = net_time_ms();
+    if (!c->created) c->created = now;
+    if (!c->last_active) c->last_active = c->created;
+    if (c->connecting && !c->last_write) c->last_write = c->created;
+
+    // already overdue under the new deadlines, let the timer close it.
+    if (net_connection_deadline(c, now, &next)) next = now + 1;
+
+    net_timer_start(t, net_connection_on_timeout, c);
+    net_timer_reset_ms(t, next - now, 0);
+}
+
+
+// traffic on @c, pushes back idle/write deadlines.
+void net_connection_active(net_connect_t *c, int wrote)
+{
+    if (c->timeout_timer.timer_cb == NULL) return;
+
+    c->last_active = net_time_ms();
+    if (wrote) c->last_write = c->last_active;
+}
+
+
 void net_connection_set_close(net_connect_t *conn)
 {
     conn->closing = 1;
@@ -451,50 +1079,150 @@ int net_connection_should_close(net_connect_t *c)
 }
 
 
+// outbuf fully flushed.
+void net_connection_send_done(net_connect_t *conn)
+{
+    // it's possible we begin sending data before
+    // processing connect-triggered write event.
+    if (!conn->connecting)
+    {
+        net_io_stop(conn->loop, &conn->io_watcher, NET_EV_WRITE);
+    }
+
+    conn->last_write = 0;
+
+    // spliced input waits for our own output, it may go on now.
+    if (conn->pipe_source && conn->pipe_source->pipe_bytes)
+    {
+        net_pipe_flush(conn->pipe_source);
+    }
+
+    // every application net_connect_send() triggers this callback once.
+    if (conn->on_write_done)
+    {
+        (conn->on_write_done)(conn, conn->done_data);
+    }
+
+    // input held back while the reply was in flight (async engines).
+    if (!conn->processing && !conn->err &&
+            conn->inbuf->consume < conn->inbuf->pos)
+    {
+        net_connection_process(conn);
+    }
+
+    /* We may be deep in a callback (timer, drained watermark) that still
+     * uses @conn, so a close asked for by now is left to the loop, which
+     * runs net_tcp_io() once more. */
+    if (conn->closing && list_empty(&conn->outbuf) && !conn->io_watcher.posted)
+    {
+        conn->io_watcher.events = 0;
+        net_io_post(conn->loop, &conn->io_watcher);
+    }
+}
+
+
 void net_connection_send(net_connect_t *conn)
 {
-    ssize_t n;
+    ssize_t n, written, total, left;
+    int cnt;
     list_t *node, *node_next;
-    net_buf_t *output;
+    net_buf_t *output, *file;
+    struct iovec iov[IOV_MAX];
 
-    LIST_FOR_EACH_SAFE(&conn->outbuf, node, node_next)
+    // write deadline starts once there is something to send.
+    if (conn->timeout_timer.timer_cb && !conn->last_write)
     {
-        output = container_of(node, net_buf_t, node);
+        conn->last_write = net_time_ms();
+    }
+
+    // out_bytes grew with net_connection_append() since the last check.
+    if (conn->high_watermark) net_connection_watermark(conn);
 
-        if (output->pos)
+    if (conn->loop->engine == NET_ENGINE_URING)
+    {
+        net_uring_send(conn);
+        return;
+    }
+
+    while (!list_empty(&conn->outbuf))
+    {
+        // gather pending buffers, flush them with one syscall.
+        cnt = 0;
+        total = 0;
+        file = NULL;
+        LIST_FOR_EACH(&conn->outbuf, node)
         {
-            n = write(conn->io_watcher.fd,
-                    output->buf + output->consume,
-                    output->pos - output->consume);
-            if (n >= 0)
+            if (cnt == IOV_MAX) break;
+
+            output = container_of(node, net_buf_t, node);
+            if (output->pos == output->consume) continue;
+
+            // file segments go out on their own, through sendfile().
+            if (net_buf_is_file(output))
             {
-                output->consume += n;
-                if (output->pos > output->consume)
-                {
-                    break;
-                }
-                else {
-                    logdebug("[conn: %p, fd: %d] send data, size: %ld\n",
-                            conn, conn->io_watcher.fd, n);
-                    net_buf_del(output);
-                }
+                if (cnt == 0) file = output;
+                break;
+            }
+
+            iov[cnt].iov_base = output->buf + output->consume;
+            iov[cnt].iov_len = output->pos - output->consume;
+            total += iov[cnt].iov_len;
+            cnt++;
+        }
+
+        if (cnt || file)
+        {
+            if (file)
+            {
+                total = file->pos - file->consume;
+                n = net_buf_sendfile(conn, file);
             }
             else {
+                n = writev(conn->io_watcher.fd, iov, cnt);
+            }
+
+            if (n < 0)
+            {
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
                 {
                     // somehow, fd not ready for writing :(
                     logdebug("[conn: %p, fd: %d] write not ready now: %s\n",
                             conn, conn->io_watcher.fd, strerror(errno));
-                    break;
                 }
                 else {
                     logerr("[conn: %p, fd: %d] write error: %s\n",
                             conn, conn->io_watcher.fd, strerror(errno));
                     conn->err = 1;
-                    break;
                 }
+                break;
             }
+
+            logdebug("[conn: %p, fd: %d] send data, size: %ld\n",
+                    conn, conn->io_watcher.fd, n);
+            if (n > 0) net_connection_active(conn, 1);
+        }
+        else {
+            n = 0;
         }
+        written = n;
+
+        // release what has been written, partial one stays at head.
+        LIST_FOR_EACH_SAFE(&conn->outbuf, node, node_next)
+        {
+            output = container_of(node, net_buf_t, node);
+            left = output->pos - output->consume;
+            if (n < left)
+            {
+                output->consume += n;
+                break;
+            }
+            n -= left;
+            net_buf_del(output);
+        }
+        if (written > 0) net_connection_sent(conn, written);
+
+        // socket buffer is full, wait next time.
+        if (written < total) break;
     }
 
     if (conn->err)
@@ -505,18 +1233,7 @@ void net_connection_send(net_connect_t *conn)
 
     if (list_empty(&conn->outbuf))
     {
-        // it's possible we begin sending data before
-        // processing connect-triggered write event.
-        if (!conn->connecting)
-        {
-            net_io_stop(conn->loop, &conn->io_watcher, NET_EV_WRITE);
-        }
-
-        // every application net_connect_send() triggers this callback once.
-        if (conn->on_write_done)
-        {
-            (conn->on_write_done)(conn, conn->done_data);
-        }
+        net_connection_send_done(conn);
     }
     else {
         logdebug("[conn: %p, fd: %d] write partial, wait next time.\n",
@@ -535,47 +1252,22 @@ void net_connection_send(net_connect_t *conn)
 }
 
 
-void net_connection_on_readable(net_connect_t *c)
+// hand buffered input to on_message until it stops making progress.
+void net_connection_process(net_connect_t *c)
 {
-    int has_more = 1, recv_bytes, parsed_bytes = 0;
+    int parsed_bytes = 0;
 
-pending_data:
-
-    // realloc buf, prepare for next req
-    c->inbuf = net_buf_realloc(c->inbuf);
-
-    recv_bytes = recv(c->io_watcher.fd, c->inbuf->buf + c->inbuf->pos,
-            c->inbuf->size - c->inbuf->pos, 0);
+    c->processing = 1;
 
-    if (recv_bytes > 0)
+    while (c->inbuf->consume < c->inbuf->pos)
     {
-        logdebug("[conn: %p, fd: %d] recv data, size: %d\n",
-                c, c->io_watcher.fd, recv_bytes);
-        c->inbuf->pos += recv_bytes;
-    }
-    else if (recv_bytes == 0) {
-        logdebug("[conn: %p, fd: %d] recv 0, closing connection.\n",
-                c, c->io_watcher.fd);
-        net_connection_close(c);
-        return;
-    }
-    else {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        if (c->pipe_peer)
         {
-            has_more = 0;
-        }
-        else {
-            logerr("[conn: %p, fd: %d] recv error: %s\n",
-                    c, c->io_watcher.fd, strerror(errno));
-            c->err = 1;
-            net_connection_close(c);
-            return;
+            parsed_bytes = net_pipe_copy(c,
+                    c->inbuf->buf + c->inbuf->consume,
+                    c->inbuf->pos - c->inbuf->consume);
         }
-    }
-
-    while (has_more && c->inbuf->consume < c->inbuf->pos)
-    {
-        if (c->server && c->server->on_message)
+        else if (c->server && c->server->on_message)
         {
             parsed_bytes = (c->server->on_message)(
                     c->inbuf->buf + c->inbuf->consume,
@@ -611,12 +1303,6 @@ pending_data:
                 {
                     net_connection_error(c, "message process error");
                 }
-                // too much single req data
-                else if (net_buf_full(c->inbuf) && c->inbuf->req_cnt == 0)
-                {
-                    net_connection_error(c,
-                            "single packet contains too much data");
-                }
                 else {
                     logerr("[omg] message process error: %d\n", parsed_bytes);
                 }
@@ -628,11 +1314,128 @@ pending_data:
         }
     }
 
+    c->processing = 0;
+
+    // read deadline covers a message from its first byte on.
+    if (c->timeout_timer.timer_cb)
+    {
+        if (c->inbuf->consume == c->inbuf->pos) c->msg_since = 0;
+        else if (!c->msg_since) c->msg_since = net_time_ms();
+    }
+}
+
+
+// data already received by the engine (io_uring provided buffers).
+void net_connection_feed(net_connect_t *c, const char *data, int len)
+{
+    int n;
+
+    net_connection_active(c, 0);
+
+    while (len > 0)
+    {
+        n = net_buf_reserve(c->inbuf,
+                len < NET_READ_MIN ? len : NET_READ_MIN, c->max_inbuf);
+
+        // received before a suspend took effect, keep it past max_inbuf.
+        if (n <= 0 && !c->io_watcher.reading)
+        {
+            n = net_buf_reserve(c->inbuf, len, c->inbuf->size * 2 + len);
+        }
+        if (n <= 0)
+        {
+            net_connection_error(c, "incomplete message exceeds max_inbuf");
+            break;
+        }
+        if (n > len) n = len;
+
+        memcpy(c->inbuf->buf + c->inbuf->pos, data, n);
+        c->inbuf->pos += n;
+        data += n;
+        len -= n;
+
+        net_connection_process(c);
+        if (c->err || c->closing) break;
+    }
+
+    net_connection_should_close(c);
+}
+
+
+// read budget of @c used up, go on once other ready fds had their turn.
+void net_connection_yield(net_connect_t *c)
+{
+    logdebug("[conn: %p, fd: %d] read budget used up, yield.\n",
+            c, c->io_watcher.fd);
+    c->io_watcher.events = EPOLLIN;
+    net_io_post(c->loop, &c->io_watcher);
+}
+
+
+void net_connection_on_readable(net_connect_t *c)
+{
+    int has_more = 1, recv_bytes, room, budget = c->read_budget;
+
+    // suspended after being posted.
+    if (!c->io_watcher.reading) return;
+
+pending_data:
+
+    // make room for next read, grows inbuf while a request is incomplete
+    room = net_buf_reserve(c->inbuf, NET_READ_MIN, c->max_inbuf);
+    if (room <= 0)
+    {
+        net_connection_error(c, "incomplete message exceeds max_inbuf");
+        net_connection_should_close(c);
+        return;
+    }
+
+    recv_bytes = recv(c->io_watcher.fd, c->inbuf->buf + c->inbuf->pos,
+            room, 0);
+
+    if (recv_bytes > 0)
+    {
+        logdebug("[conn: %p, fd: %d] recv data, size: %d\n",
+                c, c->io_watcher.fd, recv_bytes);
+        c->inbuf->pos += recv_bytes;
+        budget -= recv_bytes;
+        net_connection_active(c, 0);
+    }
+    else if (recv_bytes == 0) {
+        logdebug("[conn: %p, fd: %d] recv 0, closing connection.\n",
+                c, c->io_watcher.fd);
+        net_connection_close(c);
+        return;
+    }
+    else {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            has_more = 0;
+        }
+        else {
+            logerr("[conn: %p, fd: %d] recv error: %s\n",
+                    c, c->io_watcher.fd, strerror(errno));
+            c->err = 1;
+            net_connection_close(c);
+            return;
+        }
+    }
+
+    if (has_more) net_connection_process(c);
+
     // if user require closing, then we don't need to retrive remaining data
     if (net_connection_should_close(c)) return;
 
     // Normally, we'll keep receiving data until EAGAIN.
-    if (c->io_watcher.reading && has_more) goto pending_data;
+    if (c->io_watcher.reading && has_more)
+    {
+        if (c->read_budget > 0 && budget <= 0)
+        {
+            net_connection_yield(c);
+            return;
+        }
+        goto pending_data;
+    }
 }
 
 
@@ -649,6 +1452,7 @@ void net_io_init(net_io_t *io, net_io_cb cb, int fd)
 // io event callback
 void net_tcp_io(net_io_t *w)
 {
+    int fd = w->fd;
     uint32_t events = w->events;
     net_connect_t *c = container_of(w, net_connect_t, io_watcher);
 
@@ -664,62 +1468,95 @@ void net_tcp_io(net_io_t *w)
         else logerr("[conn: %p, fd: %d] no read handler!\n", c, w->fd);
     }
 
-    if (events & EPOLLOUT)
+    // on_read may have closed @c, it stays in memory until the batch ends.
+    if ((events & EPOLLOUT) && w->alive)
     {
         logdebug("[conn: %p, fd: %d] writeable event occurs.\n", c, w->fd);
         if (c->on_write) c->on_write(c);
         else logerr("[conn: %p, fd: %d] no write handler!\n", c, w->fd);
     }
 
+    // a close waiting for outbuf to drain is due once it's flushed.
+    if (w->alive) net_connection_should_close(c);
+
+    // @c may be closed by now, don't touch it.
     if (events & EPOLLHUP)
     {
-        logdebug("[conn: %p, fd: %d] peer close!\n", c, w->fd);
+        logdebug("[conn: %p, fd: %d] peer close!\n", c, fd);
     }
 }
 
 
-void net_on_accept(net_connect_t *c)
+// set up a connection for @est_fd accepted on listening connection @c.
+void net_accept_connection(net_connect_t *c, int est_fd,
+        struct sockaddr_in *addr)
 {
     char addr_str[INET_ADDRSTRLEN];
-    struct sockaddr_in addr;
-    socklen_t addr_len = sizeof(addr);
     net_server_t *server = c->server;
-    int est_fd;
 
-    while(1) /* in case of multiple ready connections */
+    net_connect_t *new_c = net_connection_new(c->loop, est_fd);
+    if (new_c == NULL)
     {
-        est_fd = accept(c->io_watcher.fd, (struct sockaddr *)&addr, &addr_len);
+        close(est_fd);
+        return;
+    }
+    memcpy(&new_c->remote_addr, addr, sizeof(struct sockaddr_in));
 
-        if (est_fd > 0)
-        {
-            if (setnoblock(est_fd))
-            {
-                logerr("set non-block failed: %s\n", strerror(errno));
-                continue;
-            }
+    new_c->server = server;
+    new_c->max_inbuf = server->max_inbuf;
+    new_c->read_budget = server->read_budget;
+    net_connection_set_timeouts(new_c, &server->timeouts);
+    list_add(&server->conn_list, &new_c->node);
+
+    new_c->on_read = net_connection_on_readable;
+    new_c->on_write_done = server->on_write_done;
+    new_c->done_data = server->done_data;
+    new_c->on_error = server->on_error;
+
+    net_io_init(&new_c->io_watcher, net_tcp_io, est_fd);
+    net_connection_read_start(new_c);
 
-            net_connect_t *new_c = net_connection_new(c->loop, est_fd);
-            memcpy(&new_c->remote_addr, &addr, addr_len);
+    if (server->on_accept)
+    {
+        server->on_accept(new_c, server->accept_data);
+    }
 
-            new_c->server = server;
-            list_add(&server->conn_list, &new_c->node);
+    inet_ntop(AF_INET, &addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+    logdebug("[conn: %p, fd: %d] accept from %s:%d\n",
+            new_c, est_fd, addr_str, ntohs(addr->sin_port));
+}
 
-            new_c->on_read = net_connection_on_readable;
-            new_c->on_write_done = server->on_write_done;
-            new_c->done_data = server->done_data;
-            new_c->on_error = server->on_error;
 
-            net_io_init(&new_c->io_watcher, net_tcp_io, est_fd);
-            net_io_start(new_c->loop, &new_c->io_watcher, NET_EV_READ);
+void net_on_accept(net_connect_t *c)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    int est_fd, budget = c->server->accept_budget;
 
-            if (server->on_accept)
-            {
-                server->on_accept(new_c, server->accept_data);
-            }
+    // io_uring accepts through multishot, only its leftovers come here.
+    if (c->loop->engine == NET_ENGINE_URING)
+    {
+        net_uring_accept_backlog(c);
+        return;
+    }
+
+    while(1) /* in case of multiple ready connections */
+    {
+        // leave the rest of a burst for after established connections.
+        if (budget-- == 0)
+        {
+            logdebug("accept budget used up, continue next round.\n");
+            net_io_post(c->loop, &c->io_watcher);
+            break;
+        }
+
+        addr_len = sizeof(addr);
+        est_fd = accept4(c->io_watcher.fd, (struct sockaddr *)&addr,
+                &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-            inet_ntop(AF_INET, &addr.sin_addr, addr_str, INET_ADDRSTRLEN);
-            logdebug("[conn: %p, fd: %d] accept from %s:%d\n",
-                    new_c, est_fd, addr_str, ntohs(addr.sin_port));
+        if (est_fd >= 0)
+        {
+            net_accept_connection(c, est_fd, &addr);
         }
         else {
             if (errno == EWOULDBLOCK || errno == EAGAIN)
@@ -770,7 +1607,7 @@ void net_on_connect(net_connect_t *c)
 
         // setup handler for server response
         c->on_read = net_connection_on_readable;
-        net_io_start(c->loop, &c->io_watcher, NET_EV_READ);
+        net_connection_read_start(c);
     }
     else {
         logerr("connected to '%s:%d' failed: %s\n",
@@ -788,33 +1625,160 @@ void net_on_connect(net_connect_t *c)
 }
 
 
+/*
+ * Run @fn(@arg) on @loop's thread, callable from any thread. Tasks run
+ * in posting order, right after the loop's current round of events.
+ */
+int net_loop_post(net_loop_t *loop, task_handler fn, void *arg)
+{
+    uint64_t one = 1;
+    net_task_t *t, *head;
+
+    t = malloc(sizeof(net_task_t));
+    if (t == NULL)
+    {
+        logerr("task malloc failed.\n");
+        return NET_ERR;
+    }
+    t->fn = fn;
+    t->arg = arg;
+
+    head = __atomic_load_n(&loop->tasks, __ATOMIC_RELAXED);
+    do {
+        t->next = head;
+    } while (!__atomic_compare_exchange_n(&loop->tasks, &head, t, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // only the first task of a batch needs to wake the loop.
+    if (head == NULL &&
+            write(loop->task_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        logerr("wake loop failed: %s\n", strerror(errno));
+    }
+
+    return NET_OK;
+}
+
+
+void net_loop_run_tasks(net_loop_t *loop)
+{
+    net_task_t *t, *next, *fifo = NULL;
+
+    t = __atomic_exchange_n(&loop->tasks, NULL, __ATOMIC_ACQUIRE);
+
+    // the stack holds them newest first.
+    while (t)
+    {
+        next = t->next;
+        t->next = fifo;
+        fifo = t;
+        t = next;
+    }
+
+    for (t = fifo; t; t = next)
+    {
+        next = t->next;
+        t->fn(t->arg);
+        free(t);
+    }
+}
+
+
+void net_loop_on_task(net_io_t *w)
+{
+    uint64_t cnt;
+    net_loop_t *loop = container_of(w, net_loop_t, task_watcher);
+
+    if (read(loop->task_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+    {
+        logerr("read loop eventfd failed: %s\n", strerror(errno));
+    }
+
+    net_loop_run_tasks(loop);
+}
+
+
+// a full evlist means more is ready, take it in one wait next time.
+void net_loop_grow_events(net_loop_t *loop)
+{
+    int size = loop->size * 2;
+    struct epoll_event *evlist;
+
+    if (size > NET_EVLIST_MAX) size = NET_EVLIST_MAX;
+    if (size <= loop->size) return;
+
+    evlist = realloc(loop->evlist, sizeof(struct epoll_event) * size);
+    if (evlist == NULL)
+    {
+        logerr("grow evlist to %d failed.\n", size);
+        return;
+    }
+
+    logdebug("evlist grown to %d.\n", size);
+
+    loop->evlist = evlist;
+    loop->size = size;
+}
+
+
 void net_loop_start(net_loop_t *loop)
 {
     int n, idx;
-    list_t *node, *node_next;
+    list_t postponed, *node, *node_next;
     net_io_t *w;
 
     signal(SIGPIPE, SIG_IGN);
 
-    while(!loop->stop)
+    while(!__atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE))
     {
-        int timer = 1 * 1000; // unit is millisecond
-        n = epoll_wait(loop->epfd, loop->evlist, loop->size, timer);
+        // sleep until the nearest timer (ms), -1 without any.
+        // posted tasks and stop wake us up through task_fd.
+        int timer = net_wheel_timeout(loop);
+
+        // postponed work left, just poll.
+        if (!list_empty(&loop->postpone_events)) timer = 0;
+
+        if (loop->engine == NET_ENGINE_URING)
+        {
+            // completions are dispatched within
+            net_uring_wait(loop, timer);
+            n = 0;
+        }
+        else {
+            n = epoll_wait(loop->epfd, loop->evlist, loop->size, timer);
+        }
 
         // process normal events
         for (idx = 0; idx < n; idx++)
         {
             logdebug("epoll idx: %d, total: %d\n", idx, n);
             w = loop->evlist[idx].data.ptr;
+
+            // connection closed earlier in this batch.
+            if (!w->alive) continue;
+
             w->events = loop->evlist[idx].events;
+
+            // next watcher is likely cold, fetch it while this one runs.
+            if (idx + 1 < n)
+                __builtin_prefetch(loop->evlist[idx + 1].data.ptr, 1);
+
             w->cb(w);
         }
 
-        // process postpone events
-        LIST_FOR_EACH_SAFE(&loop->postpone_events, node, node_next)
+        if (n == loop->size) net_loop_grow_events(loop);
+        net_connection_recycle(loop);
+
+        net_wheel_expire(loop);
+
+        // process postpone events, ones posted meanwhile wait a round.
+        list_init(&postponed);
+        list_splice(&postponed, &loop->postpone_events);
+        while (!list_empty(&postponed))
         {
-            w = container_of(node, net_io_t, node);
+            w = container_of(postponed.next, net_io_t, node);
             list_del(&w->node);
+            w->posted = 0;
             w->cb(w);
         }
     }
@@ -824,6 +1788,21 @@ void net_loop_start(net_loop_t *loop)
         (loop->on_stop)(loop, loop->stop_data);
     }
 
+    // whatever was posted before stop still runs.
+    net_loop_run_tasks(loop);
+    net_io_stop(loop, &loop->task_watcher, NET_EV_ALL);
+    close(loop->task_fd);
+
+    list_splice(&loop->free_conns, &loop->closed_conns);
+    LIST_FOR_EACH_SAFE(&loop->free_conns, node, node_next)
+    {
+        free(container_of(node, net_connect_t, node));
+    }
+    free(loop->conns);
+
+    net_wheel_destroy(loop);
+    net_uring_destroy(loop);
+    net_buf_pool_destroy(&loop->buf_pool);
     free(loop->evlist);
     free(loop);
 
@@ -831,9 +1810,22 @@ void net_loop_start(net_loop_t *loop)
 }
 
 
+void net_loop_stop_task(void *arg)
+{
+    net_loop_t *loop = arg;
+
+    __atomic_store_n(&loop->stop, 1, __ATOMIC_RELEASE);
+}
+
+
+/* safe from any thread, the loop wakes up and returns. The flag is set
+ * by the loop itself, it may be freed as soon as it's seen. */
 void net_loop_stop(net_loop_t *loop)
 {
-    loop->stop = 1;
+    if (net_loop_post(loop, net_loop_stop_task, loop) != NET_OK)
+    {
+        logerr("stop loop failed.\n");
+    }
 }
 
 
@@ -848,7 +1840,25 @@ net_loop_t *net_loop_init(size_t epoll_size)
 
     _loop->stop = 0;
     _loop->size = epoll_size;
-   list_init(&_loop->postpone_events);
+    _loop->engine = NET_ENGINE_EPOLL;
+    _loop->uring = NULL;
+    _loop->wheel = NULL;
+    _loop->tasks = NULL;
+    _loop->conns = NULL;
+    _loop->conns_size = 0;
+    _loop->nfree_conns = 0;
+    list_init(&_loop->free_conns);
+    list_init(&_loop->closed_conns);
+    list_init(&_loop->postpone_events);
+    net_buf_pool_init(&_loop->buf_pool);
+
+    if (loop_engine == NET_ENGINE_URING)
+    {
+        if (net_uring_init(_loop) == NET_OK)
+            _loop->engine = NET_ENGINE_URING;
+        else
+            logerr("io_uring unavailable, fallback to epoll.\n");
+    }
 
     _loop->evlist = malloc(sizeof(struct epoll_event) * _loop->size);
     if (_loop->evlist == NULL)
@@ -861,18 +1871,39 @@ net_loop_t *net_loop_init(size_t epoll_size)
     if (_loop->epfd == -1)
     {
         logerr("epoll_create failed.\n");
+        net_uring_destroy(_loop);
         free(_loop->evlist);
         free(_loop);
         return NULL;
     }
     logdebug("loop init succ, epfd: %d\n", _loop->epfd);
 
+    _loop->task_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_loop->task_fd == -1)
+    {
+        logerr("eventfd failed: %s\n", strerror(errno));
+        close(_loop->epfd);
+        net_uring_destroy(_loop);
+        free(_loop->evlist);
+        free(_loop);
+        return NULL;
+    }
+    net_io_init(&_loop->task_watcher, net_loop_on_task, _loop->task_fd);
+    net_io_start(_loop, &_loop->task_watcher, NET_EV_READ);
+
     net_loop_set_stop_callback(_loop, NULL, NULL);
 
     return _loop;
 }
 
 
+// choose the io engine of loops created afterwards.
+void net_loop_engine(int engine)
+{
+    loop_engine = engine;
+}
+
+
 void net_loop_set_stop_callback(net_loop_t *loop, stop_handler cb, void *arg)
 {
     loop->on_stop = cb;
@@ -880,6 +1911,164 @@ void net_loop_set_stop_callback(net_loop_t *loop, stop_handler cb, void *arg)
 }
 
 
+/* @nloops <= 0 means one loop per online cpu. */
+net_loop_group_t *net_loop_group_init(int nloops, size_t epoll_size)
+{
+    int i;
+    net_loop_group_t *group;
+
+    if (nloops <= 0) nloops = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nloops <= 0) nloops = 1;
+
+    group = calloc(1, sizeof(net_loop_group_t));
+    if (group == NULL)
+    {
+        logerr("loop group malloc failed.\n");
+        return NULL;
+    }
+
+    group->nloops = nloops;
+    group->loops = calloc(nloops, sizeof(net_loop_t *));
+    group->threads = calloc(nloops, sizeof(pthread_t));
+    if (group->loops == NULL || group->threads == NULL)
+    {
+        logerr("loop group malloc failed.\n");
+        goto fail;
+    }
+
+    for (i = 0; i < nloops; i++)
+    {
+        group->loops[i] = net_loop_init(epoll_size);
+        if (group->loops[i] == NULL) goto fail;
+    }
+
+    logdebug("loop group init succ, loops: %d\n", nloops);
+
+    return group;
+
+fail:
+    if (group->loops)
+    {
+        for (i = 0; i < nloops && group->loops[i]; i++)
+        {
+            net_uring_destroy(group->loops[i]);
+            close(group->loops[i]->epfd);
+            free(group->loops[i]->evlist);
+            free(group->loops[i]);
+        }
+    }
+    free(group->loops);
+    free(group->threads);
+    free(group);
+    return NULL;
+}
+
+
+void net_loop_group_set_affinity(net_loop_group_t *group, int on)
+{
+    group->cpu_affinity = on;
+}
+
+
+static void net_loop_group_pin(net_loop_group_t *group, int idx)
+{
+    int ncpu, err;
+    cpu_set_t set;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) return;
+
+    CPU_ZERO(&set);
+    CPU_SET(idx % ncpu, &set);
+
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err)
+    {
+        logerr("pin loop %d to cpu %d failed: %s\n",
+                idx, idx % ncpu, strerror(err));
+    }
+}
+
+
+struct net_loop_group_arg {
+    net_loop_group_t *group;
+    int idx;
+};
+
+
+static void *net_loop_group_thread(void *arg)
+{
+    struct net_loop_group_arg *ga = arg;
+
+    if (ga->group->cpu_affinity) net_loop_group_pin(ga->group, ga->idx);
+
+    logdebug("loop %d running.\n", ga->idx);
+    net_loop_start(ga->group->loops[ga->idx]);
+
+    return NULL;
+}
+
+
+/*
+ * loop[0] runs on the calling thread, the others get a thread each.
+ * Returns once every loop has stopped, the group is freed then.
+ */
+void net_loop_group_start(net_loop_group_t *group)
+{
+    int i, err;
+    struct net_loop_group_arg *args;
+
+    args = calloc(group->nloops, sizeof(struct net_loop_group_arg));
+    if (args == NULL)
+    {
+        logerr("loop group malloc failed.\n");
+        return;
+    }
+
+    for (i = 0; i < group->nloops; i++)
+    {
+        args[i].group = group;
+        args[i].idx = i;
+    }
+
+    for (i = 1; i < group->nloops; i++)
+    {
+        err = pthread_create(&group->threads[i], NULL,
+                net_loop_group_thread, &args[i]);
+        if (err)
+        {
+            logerr("create loop thread %d failed: %s\n", i, strerror(err));
+            group->threads[i] = 0;
+        }
+    }
+
+    net_loop_group_thread(&args[0]);
+
+    for (i = 1; i < group->nloops; i++)
+    {
+        if (group->threads[i]) pthread_join(group->threads[i], NULL);
+    }
+
+    free(args);
+    free(group->loops);
+    free(group->threads);
+    free(group);
+
+    logdebug("loop group end.\n");
+}
+
+
+void net_loop_group_stop(net_loop_group_t *group)
+{
+    int i;
+
+    for (i = 0; i < group->nloops; i++)
+    {
+        net_loop_stop(group->loops[i]);
+    }
+}
+
+
 net_server_t *net_server_init(net_loop_t *loop, char *host, int port)
 {
     int listen_fd;
@@ -891,6 +2080,9 @@ net_server_t *net_server_init(net_loop_t *loop, char *host, int port)
     server->loop = loop;
     server->local_host = host;
     server->local_port = port;
+    server->max_inbuf = NET_INBUF_MAX;
+    server->read_budget = NET_READ_BUDGET;
+    server->accept_budget = NET_ACCEPT_BUDGET;
     list_init(&server->conn_list);
 
     net_connect_t *c = net_connection_new(loop, listen_fd);
@@ -899,7 +2091,10 @@ net_server_t *net_server_init(net_loop_t *loop, char *host, int port)
 
     // arm io(read) event
     net_io_init(&c->io_watcher, net_tcp_io, listen_fd);
-    net_io_start(loop, &c->io_watcher, NET_EV_READ);
+    if (loop->engine == NET_ENGINE_URING)
+        net_uring_accept(c);
+    else
+        net_io_start(loop, &c->io_watcher, NET_EV_READ);
 
     server->conn_listen = c;
 
@@ -942,6 +2137,48 @@ void net_server_set_done_callback(net_server_t *s, done_handler cb, void *arg)
 }
 
 
+// largest request a connection may buffer before it is dropped.
+void net_server_set_max_inbuf(net_server_t *s, int size)
+{
+    s->max_inbuf = size;
+}
+
+
+// bytes a connection reads per wakeup before others get their turn,
+// <= 0 reads until EAGAIN.
+void net_server_set_read_budget(net_server_t *s, int bytes)
+{
+    s->read_budget = bytes;
+}
+
+
+// takes effect at once, the kernel caps it at net.core.somaxconn.
+int net_server_set_backlog(net_server_t *s, int backlog)
+{
+    if (listen(s->conn_listen->io_watcher.fd, backlog))
+    {
+        logerr("listen failed: %s\n", strerror(errno));
+        return NET_ERR;
+    }
+
+    return NET_OK;
+}
+
+
+// connections accepted per loop iteration at most, <= 0 for no limit.
+void net_server_set_accept_budget(net_server_t *s, int budget)
+{
+    s->accept_budget = budget > 0 ? budget : -1;
+}
+
+
+// deadlines for connections accepted from now on, see net_timeouts_t.
+void net_server_set_timeouts(net_server_t *s, net_timeouts_t *to)
+{
+    s->timeouts = *to;
+}
+
+
 net_client_t *net_client_init(net_loop_t *loop, char *host, int port)
 {
     net_client_t *client;
@@ -1006,6 +2243,27 @@ void net_client_set_keep_alive(net_client_t *client, int keep_alive)
 }
 
 
+void net_client_set_max_inbuf(net_client_t *client, int size)
+{
+    net_connect_t *c = client->conn;
+    c->max_inbuf = size;
+}
+
+
+void net_client_set_read_budget(net_client_t *client, int bytes)
+{
+    net_connect_t *c = client->conn;
+    c->read_budget = bytes;
+}
+
+
+// write deadline also bounds the pending connect.
+void net_client_set_timeouts(net_client_t *client, net_timeouts_t *to)
+{
+    net_connection_set_timeouts(client->conn, to);
+}
+
+
 void net_client_set_close_callback(
         net_client_t *client, close_handler cb, void *arg)
 {
@@ -1016,87 +2274,71 @@ void net_client_set_close_callback(
 
 void net_timer_destroy(net_timer_t *timer)
 {
-    int fd = timer->timer_fd;
-    struct itimerspec new_value = {{0},{0}};
-
-    // disarm this timer
-    if (timerfd_settime(fd, 0, &new_value, NULL) == -1)
-    {
-        perror("timer stop: timerfd_settime failed");
-    }
-
-    net_io_stop(timer->loop, &timer->timer_watcher, NET_EV_ALL);
-    close(fd);
+    net_timer_stop(timer);
     free(timer);
     logdebug("timer stopped.\n");
 }
 
 
-// change trigger policy, also used to stop/disarm one timer
-void net_timer_reset(net_timer_t *timer, int value, int interval)
+// disarm, net_timer_reset() arms it again.
+void net_timer_stop(net_timer_t *timer)
 {
-    int fd = timer->timer_fd;
-    struct itimerspec new_value = {{interval, 0},{value, 0}};
-
-    if (timerfd_settime(fd, 0, &new_value, NULL) == -1)
-    {
-        perror("timer reset: timerfd_settime failed");
-    }
+    net_wheel_del(timer->loop, timer);
 }
 
 
-void net_timer_trigger(net_io_t *w)
+// change trigger policy (milliseconds), value 0 stops/disarms the timer
+void net_timer_reset_ms(net_timer_t *timer, int value, int interval)
 {
-    ssize_t ret;
-    uint64_t counts;
-    net_timer_t *timer = container_of(w, net_timer_t, timer_watcher);
+    net_wheel_del(timer->loop, timer);
 
-    ret = read(timer->timer_fd, &counts, sizeof(uint64_t));
-    if (ret != sizeof(uint64_t))
-    {
-        perror("read timerfd failed");
-        net_timer_destroy(timer);
-        return;
-    }
+    timer->interval = interval;
+    if (value <= 0) return;
+
+    timer->expire = net_time_ms() + value;
+    net_wheel_add(timer->loop, timer);
+}
 
-    if (counts > 1) logdebug("collapse num: %ld\n", counts);
 
-    timer->timer_cb(timer);
+// same as net_timer_reset_ms(), in seconds.
+void net_timer_reset(net_timer_t *timer, int value, int interval)
+{
+    net_timer_reset_ms(timer, value * 1000, interval * 1000);
 }
 
 
-net_timer_t* net_timer_init(net_loop_t *loop, int value, int interval)
+// set up a timer embedded in some other struct, disarmed.
+void net_timer_prepare(net_timer_t *timer, net_loop_t *loop)
 {
-    int fd = timerfd_create(CLOCK_REALTIME, 0);
-    if (fd == -1)
-    {
-        perror("timerfd_create failed");
-        return NULL;
-    }
+    memset(timer, 0, sizeof(net_timer_t));
+    timer->loop = loop;
+    timer->level = -1;
+    list_init(&timer->node);
+}
 
-    struct itimerspec new_value = { {interval, 0}, {value, 0}};
-    if (timerfd_settime(fd, 0, &new_value, NULL) == -1)
-    {
-        perror("timer init: timerfd_settime failed");
-        return NULL;
-    }
 
-    net_timer_t *timer = calloc(1, sizeof(net_timer_t));
+net_timer_t* net_timer_init_ms(net_loop_t *loop, int value, int interval)
+{
+    net_timer_t *timer = malloc(sizeof(net_timer_t));
     if (timer == NULL)
     {
-        perror("net_timer_init calloc failed");
+        perror("net_timer_init malloc failed");
         return NULL;
     }
 
-    timer->timer_fd = fd;
-    timer->loop = loop;
-
-    net_io_init(&timer->timer_watcher, net_timer_trigger, timer->timer_fd);
-    net_io_start(loop, &timer->timer_watcher, NET_EV_READ);
+    net_timer_prepare(timer, loop);
+    net_timer_reset_ms(timer, value, interval);
 
     return timer;
 }
 
+
+// same as net_timer_init_ms(), in seconds.
+net_timer_t* net_timer_init(net_loop_t *loop, int value, int interval)
+{
+    return net_timer_init_ms(loop, value * 1000, interval * 1000);
+}
+
 void net_timer_start(net_timer_t *timer, timer_handler cb, void *arg)
 {
     timer->timer_cb = cb;
@@ -3,6 +3,9 @@
 
 #include <time.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include <arpa/inet.h>
 #include <sys/timerfd.h>
 
@@ -11,20 +14,60 @@
 
 #define setnoblock(s) fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK)
 #define EPOLL_SIZE 1000
+
+// evlist doubles whenever one wait fills it, up to NET_EVLIST_MAX
+#define NET_EVLIST_MAX (64 * 1024)
 #define REQ_SIZE 512
 #define NET_BUF_SIZE 1024
 
+// inbuf grows once less than NET_READ_MIN is free, up to NET_INBUF_MAX
+// by default, see net_server_set_max_inbuf()
+#define NET_READ_MIN 128
+#define NET_INBUF_MAX (64 * 1024)
+
+// bytes read from one connection per wakeup, see net_server_set_read_budget()
+#define NET_READ_BUDGET (256 * 1024)
+
+// listen(2) backlog, see net_server_set_backlog()
+#define NET_LISTEN_BACKLOG 511
+
+// connections a server accepts per loop iteration by default
+#define NET_ACCEPT_BUDGET 64
+
+// outbuf watermarks used by net_connection_throttle() unless set
+#define NET_HIGH_WATERMARK (256 * 1024)
+#define NET_LOW_WATERMARK  (64 * 1024)
+
+// buf pool: payload size classes, and how much each loop keeps cached
+#define NET_POOL_CLASSES 4
+#define NET_POOL_CLASS_BYTES (4 << 20)
+#define NET_POOL_MAX_BUFS 4096
+
+// closed connections each loop keeps for reuse
+#define NET_CONN_CACHE 1024
+
 #define NET_OK 0
 #define NET_ERR -1
 #define NET_AGAIN -2
 
+#define NET_ENGINE_EPOLL 0
+#define NET_ENGINE_URING 1
+
+#ifndef NET_ENGINE_DEFAULT
+#define NET_ENGINE_DEFAULT NET_ENGINE_EPOLL
+#endif
+
 typedef struct net_connect_t net_connect_t;
 typedef struct net_server_t  net_server_t;
 typedef struct net_client_t  net_client_t;
 typedef struct net_timer_t   net_timer_t;
+typedef struct net_timeouts_t net_timeouts_t;
 typedef struct net_loop_t    net_loop_t;
+typedef struct net_loop_group_t net_loop_group_t;
 typedef struct net_buf_t     net_buf_t;
+typedef struct net_buf_pool_t net_buf_pool_t;
 typedef struct net_io_t      net_io_t;
+typedef struct net_task_t    net_task_t;
 
 typedef int  (*io_handler)(char *, size_t, net_connect_t *);
 typedef void (*accept_handler)(net_connect_t *, void *);
@@ -34,6 +77,8 @@ typedef void (*close_handler)(net_connect_t *, void *);
 typedef void (*error_hanlder)(const char *);
 typedef void (*stop_handler)(net_loop_t *, void*);
 typedef void (*timer_handler)(net_timer_t *);
+typedef void (*watermark_handler)(net_connect_t *, void *);
+typedef void (*task_handler)(void *);
 
 typedef void (*net_io_cb)(net_io_t *);
 
@@ -47,6 +92,69 @@ struct net_buf_t {
 
     int req_cnt;
     int auto_scale;
+
+    // owner pool, NULL for net_buf_create() bufs
+    net_buf_pool_t *pool;
+
+    // file segment (buf is NULL): [consume, pos) of the file starting
+    // at file_off is sent with sendfile(), see net_buf_file().
+    int file_fd;
+    off_t file_off;
+    void (*file_done)(void *);
+    void *file_data;
+};
+
+#define net_buf_is_file(b) ((b)->buf == NULL)
+
+/*
+ * Per-loop cache of net_buf_t headers and payloads, payloads are kept
+ * by size class. Only the thread running the loop may use it, so a
+ * pooled buf must be freed on the loop it was allocated from.
+ */
+struct net_buf_pool_t {
+    list_t bufs;
+    int nbufs;
+
+    list_t chunks[NET_POOL_CLASSES];
+    int nchunks[NET_POOL_CLASSES];
+
+    // allocations served from cache / needing malloc
+    unsigned long hits;
+    unsigned long misses;
+};
+
+struct net_timer_t {
+
+    net_loop_t *loop;
+
+    // slot in the loop's timing wheel, level -1 when not armed
+    list_t node;
+    int level;
+
+    // CLOCK_MONOTONIC expiry and period, in ms
+    uint64_t expire;
+    int interval;
+
+    timer_handler timer_cb;
+    void *timer_data;
+
+    net_connect_t *conn;
+};
+
+// connection deadlines in ms, 0 disables one
+struct net_timeouts_t {
+
+    // no traffic in either direction
+    int idle;
+
+    // a partially received message must complete within
+    int read;
+
+    // pending output (or connect) must make progress within
+    int write;
+
+    // since accept/connect, whatever the connection is doing
+    int lifetime;
 };
 
 // epoll user data ptr ( a higher level wrapper of io event )
@@ -58,6 +166,17 @@ struct net_io_t {
     int reading;
     net_io_cb cb;
     uint32_t events;
+
+    // io_uring engine bookkeeping
+    uint32_t gen;
+    uint32_t poll_seq;
+    uint32_t poll_mask;
+    int uring_recv;
+    int uring_accept;
+    int uring_accepted;
+
+    // queued on loop->postpone_events
+    int posted;
 };
 
 struct net_connect_t {
@@ -72,8 +191,53 @@ struct net_connect_t {
     struct sockaddr_in remote_addr;
 
     net_buf_t *inbuf;
+    int max_inbuf;
+    int read_budget;
     list_t outbuf;
 
+    // inside net_connection_process(), on_message is not re-entered
+    int processing;
+
+    // deadlines, checked lazily by timeout_timer (ms, CLOCK_MONOTONIC)
+    net_timeouts_t timeouts;
+    net_timer_t timeout_timer;
+    uint64_t created;
+    uint64_t last_active;
+    uint64_t last_write;
+    uint64_t msg_since;
+
+    // bytes queued in outbuf by net_connection_append(), not sent yet
+    size_t out_bytes;
+    size_t high_watermark;
+    size_t low_watermark;
+    int above_watermark;
+
+    watermark_handler on_high_watermark;
+    watermark_handler on_low_watermark;
+    void *watermark_data;
+
+    // reading of throttle_source is suspended while our outbuf is above
+    // high watermark, throttle_sink is the one suspending us.
+    net_connect_t *throttle_source;
+    net_connect_t *throttle_sink;
+    int throttled;
+
+    // net_connection_pipe(): input goes to pipe_peer, spliced through
+    // pipe_fds when they are open (-1 otherwise), copied if not.
+    net_connect_t *pipe_peer;
+    net_connect_t *pipe_source;
+    int pipe_fds[2];
+    size_t pipe_bytes;
+    int pipe_blocked;
+
+    // io_uring: sends in flight, waiting for POLLOUT
+    int send_inflight;
+    int send_blocked;
+    void *send_msg;
+
+    // thread pool jobs not completed yet, close leaves the free to them
+    int jobs;
+
     void (*on_read)(net_connect_t *);
     void (*on_write)(net_connect_t *);
     void (*on_error)(const char *);
@@ -102,6 +266,18 @@ struct net_server_t {
     list_t conn_list;
     net_loop_t *loop;
 
+    int max_inbuf;
+    int read_budget;
+    net_timeouts_t timeouts;
+
+    // accepts per loop iteration, -1 unlimited
+    int accept_budget;
+
+    // io_uring accepted these past the budget, set up in later rounds
+    int *accept_fds;
+    int accept_nfds;
+    int accept_fds_size;
+
     /* public callback */
 
     accept_handler on_accept;
@@ -143,49 +319,89 @@ struct net_client_t {
     net_loop_t *loop;
 };
 
+// closure handed to a loop by net_loop_post()
+struct net_task_t {
+    net_task_t *next;
+    task_handler fn;
+    void *arg;
+};
+
 struct net_loop_t {
 
+    int engine;
+    void *uring;
+
+    // timing wheel, created with the first timer
+    void *wheel;
+
     int epfd;
     struct epoll_event *evlist;
     int size;
 
     list_t postpone_events;
 
+    // open connections by fd, closed ones kept (zeroed) for reuse.
+    // ones closed during this iteration may still have events in
+    // evlist, they wait in closed_conns until it's dispatched.
+    net_connect_t **conns;
+    int conns_size;
+    list_t free_conns;
+    list_t closed_conns;
+    int nfree_conns;
+
+    // pushed by any thread (lock-free stack), taken all at once by the
+    // loop thread. task_fd (eventfd) wakes the loop up.
+    net_task_t *tasks;
+    int task_fd;
+    net_io_t task_watcher;
+
+    net_buf_pool_t buf_pool;
+
     int stop;
     stop_handler on_stop;
     void *stop_data;
 };
 
+// N independent loops, each driven by its own thread.
+struct net_loop_group_t {
+
+    int nloops;
+    net_loop_t **loops;
+    pthread_t *threads;
+
+    // pin loop[i] to cpu (i % online cpus)
+    int cpu_affinity;
+};
+
 enum event_type {
     NET_EV_READ,
     NET_EV_WRITE,
     NET_EV_ALL
 };
 
-struct net_timer_t {
-
-    net_loop_t *loop;
-
-    int timer_fd;
-
-    net_io_t timer_watcher;
-
-    timer_handler timer_cb;
-    void *timer_data;
-
-    net_connect_t *conn;
-};
-
 // buf
 net_buf_t *net_buf_create(size_t);
+net_buf_t *net_buf_alloc(net_loop_t *, size_t);
+void net_buf_del(net_buf_t *);
 void net_buf_append(net_buf_t *, const char *, ...);
 void net_buf_copy(net_buf_t *, char *, size_t);
+int net_buf_reserve(net_buf_t *, int, int);
+net_buf_t *net_buf_file(int, off_t, int);
 
 // loop
+void net_loop_engine(int);
 net_loop_t *net_loop_init(size_t);
 void net_loop_set_stop_callback(net_loop_t *, stop_handler, void *);
 void net_loop_start(net_loop_t *);
 void net_loop_stop(net_loop_t *);
+int  net_loop_post(net_loop_t *, task_handler, void *);
+void net_loop_buf_stats(net_loop_t *, unsigned long *, unsigned long *);
+
+// loop group
+net_loop_group_t *net_loop_group_init(int, size_t);
+void net_loop_group_set_affinity(net_loop_group_t *, int);
+void net_loop_group_start(net_loop_group_t *);
+void net_loop_group_stop(net_loop_group_t *);
 
 // server
 net_server_t *net_server_init(net_loop_t *, char *, int);
@@ -194,6 +410,11 @@ void net_server_set_message_callback(net_server_t *, io_handler);
 void net_server_set_done_callback(net_server_t *, done_handler, void *);
 void net_server_set_accept_callback(net_server_t *, accept_handler, void *);
 void net_server_set_close_callback(net_server_t *, close_handler, void *);
+void net_server_set_max_inbuf(net_server_t *, int);
+void net_server_set_read_budget(net_server_t *, int);
+void net_server_set_timeouts(net_server_t *, net_timeouts_t *);
+int  net_server_set_backlog(net_server_t *, int);
+void net_server_set_accept_budget(net_server_t *, int);
 
 // client
 net_client_t *net_client_init(net_loop_t *, char *, int);
@@ -203,18 +424,36 @@ void net_client_set_done_callback(net_client_t *, done_handler);
 void net_client_set_user_data(net_client_t *, void *);
 void net_client_set_keep_alive(net_client_t *, int);
 void net_client_set_close_callback(net_client_t *, close_handler, void *);
+void net_client_set_max_inbuf(net_client_t *, int);
+void net_client_set_read_budget(net_client_t *, int);
+void net_client_set_timeouts(net_client_t *, net_timeouts_t *);
 
 // connection
 void net_connection_set_close(net_connect_t *);
+void net_connection_append(net_connect_t *, net_buf_t *);
 void net_connection_send(net_connect_t *);
 void net_connection_close(net_connect_t *);
 void net_connection_suspend(net_connect_t *);
-
-// timer
+void net_connection_resume(net_connect_t *);
+void net_connection_set_watermarks(net_connect_t *, size_t, size_t);
+void net_connection_set_watermark_callback(net_connect_t *,
+        watermark_handler, watermark_handler, void *);
+void net_connection_throttle(net_connect_t *, net_connect_t *);
+void net_connection_pipe(net_connect_t *, net_connect_t *);
+void net_connection_process(net_connect_t *);
+void net_connection_set_timeouts(net_connect_t *, net_timeouts_t *);
+net_connect_t *net_connection_find(net_loop_t *, int);
+
+// timer, expiry and period are relative to CLOCK_MONOTONIC
+uint64_t net_time_ms(void);
 net_timer_t* net_timer_init(net_loop_t *, int, int);
+net_timer_t* net_timer_init_ms(net_loop_t *, int, int);
+void net_timer_prepare(net_timer_t *, net_loop_t *);
 void net_timer_start(net_timer_t *, timer_handler, void *);
 void* net_timer_data(net_timer_t *timer);
 void net_timer_stop(net_timer_t *timer);
 void net_timer_reset(net_timer_t *timer, int value, int interval);
+void net_timer_reset_ms(net_timer_t *timer, int value, int interval);
+void net_timer_destroy(net_timer_t *timer);
 
 #endif // _NET_H_
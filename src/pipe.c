@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "net.h"
+#include "pipe.h"
+#include "util.h"
+
+
+void net_pipe_on_writable(net_connect_t *c)
+{
+    net_connect_t *source = c->pipe_source;
+
+    net_io_stop(c->loop, &c->io_watcher, NET_EV_WRITE);
+    if (source == NULL) return;
+
+    if (net_pipe_flush(source) == NET_ERR) net_connection_should_close(c);
+}
+
+
+// move what @c's pipe holds to its peer, read @c again once it's empty.
+int net_pipe_flush(net_connect_t *c)
+{
+    ssize_t n;
+    net_connect_t *peer = c->pipe_peer;
+
+    while (c->pipe_bytes)
+    {
+        // peer output queued before goes first, its send_done brings us back.
+        if (peer->connecting || !list_empty(&peer->outbuf)) return NET_AGAIN;
+
+        n = splice(c->pipe_fds[0], NULL, peer->io_watcher.fd, NULL,
+                c->pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            logdebug("[conn: %p, fd: %d] splice to peer, size: %ld\n",
+                    c, c->io_watcher.fd, n);
+            c->pipe_bytes -= n;
+            net_connection_active(peer, 1);
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            peer->on_write = net_pipe_on_writable;
+            net_io_start(peer->loop, &peer->io_watcher, NET_EV_WRITE);
+            return NET_AGAIN;
+        }
+
+        logerr("[conn: %p, fd: %d] splice to peer failed: %s\n",
+                peer, peer->io_watcher.fd, n ? strerror(errno) : "no data");
+        peer->err = 1;
+        return NET_ERR;
+    }
+
+    if (c->pipe_blocked)
+    {
+        c->pipe_blocked = 0;
+        net_connection_resume(c);
+    }
+
+    return NET_OK;
+}
+
+
+void net_pipe_on_readable(net_connect_t *c)
+{
+    int ret, budget = c->read_budget;
+    ssize_t n;
+    net_connect_t *peer = c->pipe_peer;
+
+    // pipe is empty here, EAGAIN always comes from the socket.
+    while (c->io_watcher.reading)
+    {
+        if (c->read_budget > 0 && budget <= 0)
+        {
+            net_connection_yield(c);
+            return;
+        }
+
+        n = splice(c->io_watcher.fd, NULL, c->pipe_fds[1], NULL,
+                NET_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n == 0)
+        {
+            logdebug("[conn: %p, fd: %d] recv 0, closing connection.\n",
+                    c, c->io_watcher.fd);
+            net_connection_close(c);
+            return;
+        }
+
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+            logerr("[conn: %p, fd: %d] splice from socket failed: %s\n",
+                    c, c->io_watcher.fd, strerror(errno));
+            c->err = 1;
+            net_connection_close(c);
+            return;
+        }
+
+        logdebug("[conn: %p, fd: %d] splice from socket, size: %ld\n",
+                c, c->io_watcher.fd, n);
+        c->pipe_bytes += n;
+        budget -= n;
+        net_connection_active(c, 0);
+
+        ret = net_pipe_flush(c);
+        if (ret == NET_ERR)
+        {
+            // may close @c as well, through the application.
+            net_connection_should_close(peer);
+            return;
+        }
+        if (ret == NET_AGAIN)
+        {
+            c->pipe_blocked = 1;
+            net_connection_suspend(c);
+        }
+    }
+}
+
+
+// fallback path, input of @c is copied into its peer's outbuf.
+int net_pipe_copy(net_connect_t *c, char *start, size_t size)
+{
+    net_buf_t *buf;
+    net_connect_t *peer = c->pipe_peer;
+
+    buf = net_buf_alloc(peer->loop, size);
+    net_buf_copy(buf, start, size);
+    net_connection_append(peer, buf);
+    net_connection_send(peer);
+
+    return size;
+}
+
+
+// @c no longer relays to its peer, input goes to on_message again.
+void net_pipe_release(net_connect_t *c)
+{
+    if (c->pipe_peer) c->pipe_peer->pipe_source = NULL;
+    c->pipe_peer = NULL;
+
+    if (c->pipe_fds[0] >= 0)
+    {
+        close(c->pipe_fds[0]);
+        close(c->pipe_fds[1]);
+        c->pipe_fds[0] = c->pipe_fds[1] = -1;
+        c->pipe_bytes = 0;
+
+        if (c->on_read == net_pipe_on_readable)
+        {
+            c->on_read = net_connection_on_readable;
+        }
+    }
+
+    if (c->pipe_blocked)
+    {
+        c->pipe_blocked = 0;
+        if (c->io_watcher.alive) net_connection_resume(c);
+    }
+}
+
+
+void net_pipe_bind(net_connect_t *c, net_connect_t *peer)
+{
+    c->pipe_peer = peer;
+    peer->pipe_source = c;
+
+    // bounds the copy path, and output the peer queues itself.
+    net_connection_throttle(peer, c);
+
+    if (c->loop->engine == NET_ENGINE_EPOLL && c->pipe_fds[0] < 0)
+    {
+        if (pipe2(c->pipe_fds, O_NONBLOCK | O_CLOEXEC) == 0)
+        {
+            c->on_read = net_pipe_on_readable;
+
+            // re-arm, so data already queued is reported to the new handler.
+            if (c->io_watcher.reading)
+            {
+                net_connection_suspend(c);
+                net_connection_read_start(c);
+            }
+        }
+        else {
+            logerr("[conn: %p, fd: %d] pipe2 failed, copy instead: %s\n",
+                    c, c->io_watcher.fd, strerror(errno));
+            c->pipe_fds[0] = c->pipe_fds[1] = -1;
+        }
+    }
+
+    // input received before goes first.
+    if (!c->processing && c->inbuf->consume < c->inbuf->pos)
+    {
+        net_connection_process(c);
+    }
+}
+
+
+// relay whatever @a receives to @b, and the other way round.
+void net_connection_pipe(net_connect_t *a, net_connect_t *b)
+{
+    net_pipe_bind(a, b);
+    net_pipe_bind(b, a);
+}
@@ -0,0 +1,33 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+#include "net.h"
+
+/*
+ * Connection relay behind net_connection_pipe().
+ *
+ * On epoll loops what a connection receives is moved to its peer with
+ * splice() through a pipe, never entering user space. The pipe is
+ * flushed after each read, reading stops while the peer can't take the
+ * rest and resumes once it's writable again. Anything the peer still
+ * has in its outbuf goes first. io_uring loops (or a failed pipe2())
+ * fall back to copying input into the peer's outbuf, throttled by the
+ * peer's watermarks.
+ */
+
+#define NET_PIPE_SIZE (64 * 1024)
+
+int  net_pipe_flush(net_connect_t *);
+int  net_pipe_copy(net_connect_t *, char *, size_t);
+void net_pipe_release(net_connect_t *);
+
+// implemented in net.c
+void net_connection_on_readable(net_connect_t *);
+void net_connection_yield(net_connect_t *);
+void net_connection_read_start(net_connect_t *);
+void net_connection_active(net_connect_t *, int);
+int  net_connection_should_close(net_connect_t *);
+void net_io_start(net_loop_t *, net_io_t *, enum event_type);
+void net_io_stop(net_loop_t *, net_io_t *, enum event_type);
+
+#endif // _PIPE_H_
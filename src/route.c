@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "route.h"
+#include "util.h"
+
+
+http_route_t *http_route_node(const char *label, int len)
+{
+    http_route_t *r = calloc(1, sizeof(http_route_t));
+
+    if (r == NULL) return NULL;
+
+    r->label = strndup(label, len);
+    r->len = len;
+    if (r->label == NULL)
+    {
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+
+http_route_t *http_route_init(void)
+{
+    return http_route_node("", 0);
+}
+
+
+http_route_t *http_route_child(http_route_t *r, char c)
+{
+    char *idx;
+
+    if (r->nchildren == 0) return NULL;
+
+    idx = memchr(r->indices, c, r->nchildren);
+    return idx ? r->children[idx - r->indices] : NULL;
+}
+
+
+int http_route_link(http_route_t *r, http_route_t *child)
+{
+    char *indices;
+    http_route_t **children;
+
+    indices = realloc(r->indices, r->nchildren + 1);
+    if (indices == NULL) return NET_ERR;
+    r->indices = indices;
+
+    children = realloc(r->children, (r->nchildren + 1) * sizeof(http_route_t *));
+    if (children == NULL) return NET_ERR;
+    r->children = children;
+
+    r->indices[r->nchildren] = child->label[0];
+    r->children[r->nchildren] = child;
+    r->nchildren++;
+
+    return NET_OK;
+}
+
+
+// cut @child's label after @n bytes, return the new node holding the head.
+http_route_t *http_route_split(http_route_t *r, http_route_t *child, int n)
+{
+    char *rest;
+    http_route_t *head;
+
+    head = http_route_node(child->label, n);
+    if (head == NULL) return NULL;
+
+    rest = strdup(child->label + n);
+    if (rest == NULL || http_route_link(head, child) != NET_OK)
+    {
+        free(rest);
+        free(head->label);
+        free(head);
+        return NULL;
+    }
+
+    // the first byte is kept, so is child's slot in @r.
+    head->indices[0] = rest[0];
+    free(child->label);
+    child->label = rest;
+    child->len -= n;
+
+    r->children[(char *)memchr(r->indices, head->label[0], r->nchildren)
+        - r->indices] = head;
+
+    return head;
+}
+
+
+// walk down @r along static text [@s, @s + @len), adding what's missing.
+http_route_t *http_route_insert(http_route_t *r, const char *s, int len)
+{
+    int n;
+    http_route_t *child;
+
+    while (len > 0)
+    {
+        child = http_route_child(r, s[0]);
+        if (child == NULL)
+        {
+            child = http_route_node(s, len);
+            if (child == NULL || http_route_link(r, child) != NET_OK)
+            {
+                if (child) free(child->label);
+                free(child);
+                return NULL;
+            }
+            return child;
+        }
+
+        for (n = 1; n < len && n < child->len && s[n] == child->label[n]; n++);
+
+        if (n < child->len)
+        {
+            child = http_route_split(r, child, n);
+            if (child == NULL) return NULL;
+        }
+
+        r = child;
+        s += n;
+        len -= n;
+    }
+
+    return r;
+}
+
+
+void http_route_allow(http_route_t *r)
+{
+    int m, n = 0;
+    http_route_entry_t *e = r->exact;
+
+    r->allow[0] = '\0';
+
+    for (m = 0; m < HTTP_ANY; m++)
+    {
+        if (e[m].handler || (m == HTTP_HEAD && e[HTTP_GET].handler))
+        {
+            n += snprintf(r->allow + n, sizeof(r->allow) - n, "%s%s",
+                    n ? ", " : "", http_method_name(m));
+        }
+    }
+}
+
+
+/*
+ * Route requests for @method (HTTP_ANY for all) matching @pattern to
+ * @handler, a later route replaces an earlier one of the same pattern.
+ */
+int http_route_add(http_route_t *r, int method, char *pattern,
+        http_handler handler, http_body_handler body, void *data)
+{
+    int prefix = 0, nparams = 0;
+    char *p = pattern, *s;
+    http_route_entry_t *e;
+
+    if (method < 0 || method > HTTP_ANY || pattern[0] != '/')
+    {
+        logerr("invalid route: %s\n", pattern);
+        return NET_ERR;
+    }
+
+    while (*p && r)
+    {
+        if (*p == ':' && p[-1] == '/')
+        {
+            s = ++p;
+            while (*p && *p != '/') p++;
+
+            if (p == s || ++nparams > HTTP_ROUTE_PARAMS)
+            {
+                logerr("invalid route parameter: %s\n", pattern);
+                return NET_ERR;
+            }
+
+            if (r->param == NULL)
+            {
+                r->param = http_route_node("", 0);
+                if (r->param == NULL) break;
+                r->param->param_name = strndup(s, p - s);
+            }
+            else if (strncmp(r->param->param_name, s, p - s) ||
+                    r->param->param_name[p - s])
+            {
+                logerr("route %s conflicts with parameter :%s\n",
+                        pattern, r->param->param_name);
+                return NET_ERR;
+            }
+
+            r = r->param;
+            continue;
+        }
+
+        if (*p == '*' && p[1] == '\0')
+        {
+            prefix = 1;
+            break;
+        }
+
+        // static text runs up to the next parameter or trailing '*'.
+        for (s = p; *p; p++)
+        {
+            if (*p == '/' && p[1] == ':') { p++; break; }
+            if (*p == '*' && p[1] == '\0') break;
+        }
+
+        r = http_route_insert(r, s, p - s);
+    }
+
+    if (r == NULL)
+    {
+        logerr("route %s malloc failed.\n", pattern);
+        return NET_ERR;
+    }
+
+    e = prefix ? &r->prefix[method] : &r->exact[method];
+    e->handler = handler;
+    e->body = body;
+    e->data = data;
+
+    if (!prefix) http_route_allow(r);
+
+    return NET_OK;
+}
+
+
+http_route_entry_t *http_route_entry(http_route_entry_t *e, int method)
+{
+    if (e[method].handler) return &e[method];
+    if (method == HTTP_HEAD && e[HTTP_GET].handler) return &e[HTTP_GET];
+    if (e[HTTP_ANY].handler) return &e[HTTP_ANY];
+
+    return NULL;
+}
+
+
+typedef struct {
+    http_request_t *req;
+    const char *end;
+
+    // path matched a pattern, not the method
+    http_route_t *other;
+
+    // parameter values in path, not terminated
+    const char *values[HTTP_ROUTE_PARAMS];
+    int lens[HTTP_ROUTE_PARAMS];
+} http_route_match_t;
+
+
+// match [@p, end) below @r, whose label is already consumed.
+http_route_entry_t *http_route_match(http_route_t *r, const char *p,
+        http_route_match_t *m)
+{
+    int n = m->req->nparams;
+    const char *seg;
+    http_route_t *child;
+    http_route_entry_t *e;
+
+    if (p == m->end)
+    {
+        e = http_route_entry(r->exact, m->req->method);
+        if (e) return e;
+        if (r->allow[0] && !m->other) m->other = r;
+    }
+    else {
+        child = http_route_child(r, *p);
+        if (child && m->end - p >= child->len &&
+                memcmp(p, child->label, child->len) == 0)
+        {
+            e = http_route_match(child, p + child->len, m);
+            if (e) return e;
+        }
+
+        if (r->param && *p != '/')
+        {
+            for (seg = p; p < m->end && *p != '/'; p++);
+
+            m->req->params[n].name = r->param->param_name;
+            m->values[n] = seg;
+            m->lens[n] = p - seg;
+            m->req->nparams = n + 1;
+
+            e = http_route_match(r->param, p, m);
+            if (e) return e;
+
+            m->req->nparams = n;
+        }
+    }
+
+    return http_route_entry(r->prefix, m->req->method);
+}
+
+
+/*
+ * Handler of @req, NULL if none. Sets req->route_data, req->on_body and
+ * parameters. If the path matched but the method didn't, @allow is set
+ * to the methods it may be requested with.
+ */
+http_handler http_route_find(http_route_t *r, http_request_t *req,
+        const char **allow)
+{
+    int i, size = 0;
+    char *buf;
+    http_route_match_t m = {0};
+    http_route_entry_t *e;
+
+    m.req = req;
+    m.end = req->path + strcspn(req->path, "?");
+    req->nparams = 0;
+
+    e = http_route_match(r, req->path, &m);
+    if (e == NULL)
+    {
+        req->nparams = 0;
+        if (allow && m.other) *allow = m.other->allow;
+        return NULL;
+    }
+
+    // path is left as is, values are copied out to terminate them.
+    for (i = 0; i < req->nparams; i++) size += m.lens[i] + 1;
+
+    if (size)
+    {
+        buf = malloc(size);
+        if (buf == NULL)
+        {
+            logerr("route parameters malloc failed.\n");
+            req->nparams = 0;
+            return NULL;
+        }
+        req->params_buf = buf;
+
+        for (i = 0; i < req->nparams; i++)
+        {
+            memcpy(buf, m.values[i], m.lens[i]);
+            buf[m.lens[i]] = '\0';
+            req->params[i].value = buf;
+            buf += m.lens[i] + 1;
+        }
+    }
+
+    req->route_data = e->data;
+    req->on_body = e->body;
+    return e->handler;
+}
+
+
+// value of route parameter @name ("id" for "/users/:id"), NULL if none.
+const char *http_req_param(http_request_t *req, const char *name)
+{
+    int i;
+
+    for (i = 0; i < req->nparams; i++)
+    {
+        if (strcmp(req->params[i].name, name) == 0) return req->params[i].value;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef _ROUTE_H_
+#define _ROUTE_H_
+
+#include "http.h"
+
+/*
+ * Request router, a compressed radix tree of url paths.
+ *
+ * A pattern is made of static text, ":name" segments matching one path
+ * segment, which handlers read back through http_req_param(), and an
+ * optional trailing '*' matching the rest of the path. Every node holds
+ * one handler per method, plus one for any method (HTTP_ANY).
+ *
+ * Lookup walks the tree once along the request path (query string left
+ * out), static edges are picked by their first byte. Static text wins
+ * over a parameter, which wins over a prefix, and the longest prefix
+ * wins among prefixes. HEAD is answered by the GET handler unless it
+ * has its own, the body it makes is not sent.
+ */
+
+typedef struct http_route_entry_t http_route_entry_t;
+
+struct http_route_entry_t
+{
+    http_handler handler;
+    http_body_handler body;
+    void *data;
+};
+
+struct http_route_t
+{
+    // edge from the parent, static text. empty for parameter nodes
+    char *label;
+    int len;
+
+    // static children, indices[i] is the first byte of children[i]
+    char *indices;
+    http_route_t **children;
+    int nchildren;
+
+    // ":name" child, matches a non empty segment
+    http_route_t *param;
+    char *param_name;
+
+    // pattern ends here, or ends here with '*'
+    http_route_entry_t exact[HTTP_ANY + 1];
+    http_route_entry_t prefix[HTTP_ANY + 1];
+
+    // Allow header of 405 answers, methods with an exact handler
+    char allow[64];
+};
+
+http_route_t *http_route_init(void);
+int  http_route_add(http_route_t *, int, char *, http_handler,
+        http_body_handler, void *);
+http_handler http_route_find(http_route_t *, http_request_t *, const char **);
+
+// implemented in http.c
+const char *http_method_name(int);
+
+#endif // _ROUTE_H_
@@ -0,0 +1,405 @@
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "static.h"
+#include "util.h"
+
+#define HTTP_STATIC_WATCH \
+    (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+
+struct {
+    const char *ext;
+    const char *type;
+} http_static_types[] = {
+    {"html", "text/html"},
+    {"htm",  "text/html"},
+    {"css",  "text/css"},
+    {"js",   "application/javascript"},
+    {"json", "application/json"},
+    {"txt",  "text/plain"},
+    {"xml",  "application/xml"},
+    {"svg",  "image/svg+xml"},
+    {"png",  "image/png"},
+    {"jpg",  "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif",  "image/gif"},
+    {"ico",  "image/x-icon"},
+    {"wasm", "application/wasm"},
+    {NULL, NULL}
+};
+
+
+const char *http_static_type(const char *path)
+{
+    int i;
+    const char *dot = strrchr(path, '.');
+
+    if (dot && !strchr(dot, '/'))
+    {
+        for (i = 0; http_static_types[i].ext; i++)
+        {
+            if (strcasecmp(dot + 1, http_static_types[i].ext) == 0)
+                return http_static_types[i].type;
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+
+void http_file_put(void *arg)
+{
+    http_file_t *f = arg;
+
+    if (--f->refs > 0) return;
+
+    close(f->fd);
+    free(f->data);
+    free(f->path);
+    free(f);
+}
+
+
+// forget @f, segments still in flight keep it open until they're done.
+void http_file_drop(http_file_cache_t *cache, http_file_t *f)
+{
+    list_t *iter;
+    http_file_t *other;
+    int shared = 0;
+
+    logdebug("static cache drop: %s\n", f->path);
+
+    hashDelete(cache->files, f->path);
+    list_del(&f->node);
+    cache->cnt--;
+
+    // the same inode reached through another path shares the watch.
+    LIST_FOR_EACH(&cache->lru, iter)
+    {
+        other = container_of(iter, http_file_t, node);
+        if (other->wd == f->wd) shared = 1;
+    }
+    if (!shared && f->wd >= 0) inotify_rm_watch(cache->inotify_fd, f->wd);
+
+    http_file_put(f);
+}
+
+
+void http_static_on_inotify(net_io_t *io)
+{
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    char *p;
+    list_t *iter, *next;
+    struct inotify_event *ev;
+    http_file_t *f;
+    http_file_cache_t *cache =
+        container_of(io, http_file_cache_t, inotify_watcher);
+
+    while ((n = read(cache->inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len)
+        {
+            ev = (struct inotify_event *)p;
+            if (ev->mask & IN_IGNORED) continue;
+
+            LIST_FOR_EACH_SAFE(&cache->lru, iter, next)
+            {
+                f = container_of(iter, http_file_t, node);
+                if (f->wd == ev->wd) http_file_drop(cache, f);
+            }
+        }
+    }
+
+    if (n < 0 && errno != EAGAIN)
+    {
+        logerr("read inotify failed: %s\n", strerror(errno));
+    }
+}
+
+
+http_file_cache_t *http_static_cache(http_static_t *st, net_loop_t *loop)
+{
+    int i;
+    http_file_cache_t *cache;
+    http_worker_t *workers = st->server->workers;
+
+    for (i = 0; i < st->nworkers; i++)
+    {
+        if (workers[i].tcp_server->loop == loop) break;
+    }
+    if (i == st->nworkers) return NULL;
+
+    if (st->caches[i]) return st->caches[i];
+
+    cache = calloc(1, sizeof(http_file_cache_t));
+    if (cache == NULL) return NULL;
+
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->inotify_fd == -1)
+    {
+        logerr("inotify_init1 failed: %s\n", strerror(errno));
+        free(cache);
+        return NULL;
+    }
+
+    list_init(&cache->lru);
+    cache->files = hashInit(HTTP_STATIC_BUCKETS);
+    cache->st = st;
+
+    net_io_init(&cache->inotify_watcher, http_static_on_inotify,
+            cache->inotify_fd);
+    net_io_start(loop, &cache->inotify_watcher, NET_EV_READ);
+
+    st->caches[i] = cache;
+    return cache;
+}
+
+
+http_file_t *http_file_open(http_file_cache_t *cache, const char *path)
+{
+    int fd;
+    struct stat sb;
+    struct tm tm;
+    char full[PATH_MAX];
+    http_file_t *f;
+    http_static_t *st = cache->st;
+
+    fd = openat(st->root_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // a net_buf_t segment length is an int, bigger files are not served.
+    if (sb.st_size > INT_MAX)
+    {
+        logerr("static file %s too large: %ld bytes\n",
+                path, (long)sb.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    f = calloc(1, sizeof(http_file_t));
+    if (f == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    f->path = strdup(path);
+    f->fd = fd;
+    f->size = sb.st_size;
+    f->refs = 1;
+    f->cache = cache;
+    f->content_type = http_static_type(path);
+
+    snprintf(f->length, sizeof(f->length), "%ld", (long)sb.st_size);
+    gmtime_r(&sb.st_mtime, &tm);
+    strftime(f->last_modified, sizeof(f->last_modified),
+            "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    snprintf(f->etag, sizeof(f->etag), "\"%lx-%lx-%lx\"",
+            (unsigned long)sb.st_ino, (unsigned long)sb.st_size,
+            (unsigned long)sb.st_mtime);
+
+    // watch before reading, a change racing with us drops it again.
+    snprintf(full, sizeof(full), "%s/%s", st->root, path);
+    f->wd = inotify_add_watch(cache->inotify_fd, full, HTTP_STATIC_WATCH);
+    if (f->wd == -1)
+    {
+        logerr("inotify_add_watch %s failed: %s\n", full, strerror(errno));
+    }
+
+    if (f->size <= HTTP_STATIC_TINY && f->size > 0)
+    {
+        f->data = malloc(f->size);
+        if (f->data && pread(fd, f->data, f->size, 0) != f->size)
+        {
+            free(f->data);
+            f->data = NULL;
+        }
+    }
+
+    return f;
+}
+
+
+http_file_t *http_file_get(http_file_cache_t *cache, const char *path)
+{
+    http_file_t *f;
+
+    if (cache->unwatched)
+    {
+        http_file_put(cache->unwatched);
+        cache->unwatched = NULL;
+    }
+
+    f = (http_file_t *)hashGet(cache->files, (char *)path);
+    if (f)
+    {
+        cache->hits++;
+        list_del(&f->node);
+        list_add(&cache->lru, &f->node);
+        return f;
+    }
+
+    cache->misses++;
+
+    f = http_file_open(cache, path);
+    if (f == NULL) return NULL;
+
+    // unwatched files can't be invalidated, serve them uncached.
+    if (f->wd == -1)
+    {
+        cache->unwatched = f;
+        return f;
+    }
+
+    if (cache->cnt == HTTP_STATIC_ENTRIES)
+    {
+        http_file_drop(cache, container_of(cache->lru.prev, http_file_t, node));
+    }
+
+    hashPut(cache->files, f->path, (char *)f);
+    list_add(&cache->lru, &f->node);
+    cache->cnt++;
+
+    return f;
+}
+
+
+// map url @path below @st->prefix to a file relative to root.
+int http_static_path(http_static_t *st, const char *url, char *path, int size)
+{
+    int len;
+    const char *end;
+
+    url += strlen(st->prefix);
+    while (*url == '/') url++;
+
+    end = url + strcspn(url, "?#");
+    len = end - url;
+
+    if (len == 0 || url[len - 1] == '/')
+    {
+        if (snprintf(path, size, "%.*sindex.html", len, url) >= size)
+            return NET_ERR;
+    }
+    else {
+        if (len >= size) return NET_ERR;
+        memcpy(path, url, len);
+        path[len] = '\0';
+    }
+
+    // no way out of root.
+    if (strcmp(path, "..") == 0 || strncmp(path, "../", 3) == 0 ||
+            strstr(path, "/../") || (len >= 3 && strcmp(path + len - 3, "/..") == 0))
+    {
+        return NET_ERR;
+    }
+
+    return NET_OK;
+}
+
+
+void http_static_handler(http_request_t *req, http_response_t *res)
+{
+    char path[PATH_MAX];
+    const char *etag;
+    net_buf_t *body;
+    http_file_t *f;
+    http_file_cache_t *cache;
+    http_static_t *st = req->route_data;
+    net_loop_t *loop = req->conn->loop;
+
+    if (http_static_path(st, req->path, path, sizeof(path)) != NET_OK)
+    {
+        http_404_process(req, res);
+        return;
+    }
+
+    cache = http_static_cache(st, loop);
+    if (cache == NULL)
+    {
+        http_res_set_status(res, 500, "Internal Server Error");
+        return;
+    }
+
+    f = http_file_get(cache, path);
+    if (f == NULL)
+    {
+        logdebug("static file not found: %s\n", path);
+        http_404_process(req, res);
+        return;
+    }
+
+    http_res_add_header(res, "Content-Type", (char *)f->content_type);
+    http_res_add_header(res, "Content-Length", f->length);
+    http_res_add_header(res, "Last-Modified", f->last_modified);
+    http_res_add_header(res, "ETag", f->etag);
+
+    etag = http_find_header(&req->headers, "If-None-Match");
+    if (etag && strcmp(etag, f->etag) == 0)
+    {
+        http_res_set_status(res, 304, "Not Modified");
+        http_res_add_header(res, "Content-Length", "0");
+    }
+    else if (f->data) {
+        body = net_buf_alloc(loop, f->size);
+        net_buf_copy(body, f->data, f->size);
+        http_res_set_body(res, body);
+    }
+    else if (f->size > 0) {
+        body = net_buf_file(f->fd, 0, f->size);
+        if (body)
+        {
+            body->file_done = http_file_put;
+            body->file_data = f;
+            f->refs++;
+            http_res_set_file_buf(res, body);
+        }
+    }
+}
+
+
+/* Serve files below directory @root for urls starting with @prefix. */
+http_static_t *http_add_static(http_server_t *server, char *prefix, char *root)
+{
+    char pattern[PATH_MAX];
+    http_static_t *st = calloc(1, sizeof(http_static_t));
+
+    if (st == NULL) return NULL;
+
+    st->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (st->root_fd == -1)
+    {
+        logerr("open static root %s failed: %s\n", root, strerror(errno));
+        free(st);
+        return NULL;
+    }
+
+    st->prefix = prefix;
+    st->root = root;
+    st->server = server;
+    st->nworkers = server->nworkers;
+    st->caches = calloc(st->nworkers, sizeof(http_file_cache_t *));
+
+    snprintf(pattern, sizeof(pattern), "%s*", prefix);
+    http_add_route_data(server, pattern, http_static_handler, st);
+
+    return st;
+}
@@ -0,0 +1,93 @@
+#ifndef _STATIC_H_
+#define _STATIC_H_
+
+#include <sys/types.h>
+
+#include "http.h"
+#include "hash.h"
+
+/*
+ * Static file route, see http_add_static().
+ *
+ * Every worker keeps its own LRU cache of open files: fd, size and the
+ * Content-Length, Last-Modified and ETag header values, plus the whole
+ * content of tiny files. A hit is served without touching the file
+ * system, big files go out through sendfile(). Cached files are watched
+ * with inotify and dropped as soon as they change. Files of 2 GiB and
+ * more are answered with 404.
+ */
+
+#define HTTP_STATIC_ENTRIES 256
+#define HTTP_STATIC_BUCKETS 1024
+#define HTTP_STATIC_TINY    4096
+
+typedef struct http_static_t http_static_t;
+typedef struct http_file_t http_file_t;
+typedef struct http_file_cache_t http_file_cache_t;
+
+struct http_file_t
+{
+    // LRU, most recently used first
+    list_t node;
+
+    // relative to root, hash key
+    char *path;
+
+    int fd;
+    int wd;
+    off_t size;
+
+    // whole content of tiny files, NULL otherwise
+    char *data;
+
+    // one for the cache, one per file segment in flight
+    int refs;
+
+    const char *content_type;
+    char length[24];
+    char last_modified[32];
+    char etag[64];
+
+    http_file_cache_t *cache;
+};
+
+// per-worker, only touched by the thread running that loop.
+struct http_file_cache_t
+{
+    list_t lru;
+    int cnt;
+    unsigned long hits, misses;
+
+    // served without a watch, so not cached. kept until the next
+    // request, its header strings are in use until the reply is built.
+    http_file_t *unwatched;
+
+    struct hashTable *files;
+
+    int inotify_fd;
+    net_io_t inotify_watcher;
+
+    http_static_t *st;
+};
+
+struct http_static_t
+{
+    char *prefix;
+    char *root;
+    int root_fd;
+
+    http_server_t *server;
+    int nworkers;
+    http_file_cache_t **caches;
+};
+
+http_static_t *http_add_static(http_server_t *, char *, char *);
+
+// implemented in http.c
+void http_404_process(http_request_t *, http_response_t *);
+
+// implemented in net.c
+void net_io_init(net_io_t *, net_io_cb, int);
+void net_io_start(net_loop_t *, net_io_t *, enum event_type);
+
+#endif // _STATIC_H_
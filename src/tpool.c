@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tpool.h"
+#include "util.h"
+
+
+// own jobs first, oldest first. then steal the newest of someone else's.
+net_job_t *net_tpool_take(net_tpool_worker_t *w)
+{
+    int i;
+    net_job_t *job = NULL;
+    net_tpool_t *pool = w->pool;
+    net_tpool_worker_t *victim;
+
+    pthread_mutex_lock(&w->lock);
+    if (!list_empty(&w->jobs))
+    {
+        job = container_of(w->jobs.next, net_job_t, node);
+        list_del(&job->node);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for (i = 1; job == NULL && i < pool->nthreads; i++)
+    {
+        victim = &pool->workers[((w - pool->workers) + i) % pool->nthreads];
+
+        pthread_mutex_lock(&victim->lock);
+        if (!list_empty(&victim->jobs))
+        {
+            job = container_of(victim->jobs.prev, net_job_t, node);
+            list_del(&job->node);
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (job) __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+
+    return job;
+}
+
+
+// on the connection's loop.
+void net_tpool_job_done(void *arg)
+{
+    net_job_t *job = arg;
+    net_connect_t *c = job->conn;
+
+    c->jobs--;
+
+    if (c->io_watcher.alive)
+    {
+        // may close @c, it's freed right away unless jobs are left.
+        if (job->done) job->done(c, job->arg);
+    }
+    else {
+        if (job->done) job->done(NULL, job->arg);
+
+        // net_connection_close() left the free to the last job.
+        if (c->jobs == 0) net_connection_free(c);
+    }
+
+    free(job);
+}
+
+
+void *net_tpool_run(void *arg)
+{
+    net_job_t *job;
+    net_tpool_worker_t *w = arg;
+    net_tpool_t *pool = w->pool;
+
+    for (;;)
+    {
+        job = net_tpool_take(w);
+        if (job)
+        {
+            job->work(job->arg);
+
+            if (net_loop_post(job->loop, net_tpool_job_done, job) != NET_OK)
+            {
+                logerr("job %p completion lost.\n", job);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_RELAXED) <= 0 &&
+                !pool->stop)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        // queued jobs are run before leaving.
+        if (pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) <= 0)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+
+net_tpool_t *net_tpool_init(int nthreads)
+{
+    int i, err;
+    net_tpool_t *pool;
+
+    if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+
+    pool = calloc(1, sizeof(net_tpool_t));
+    if (pool == NULL)
+    {
+        logerr("thread pool malloc failed.\n");
+        return NULL;
+    }
+
+    pool->workers = calloc(nthreads, sizeof(net_tpool_worker_t));
+    if (pool->workers == NULL)
+    {
+        logerr("thread pool malloc failed.\n");
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        pool->workers[i].pool = pool;
+        list_init(&pool->workers[i].jobs);
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+
+    for (i = 0; i < nthreads; i++)
+    {
+        err = pthread_create(&pool->workers[i].tid, NULL,
+                net_tpool_run, &pool->workers[i]);
+        if (err)
+        {
+            logerr("create pool thread %d failed: %s\n", i, strerror(err));
+            break;
+        }
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads == 0)
+    {
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    logdebug("thread pool init succ, threads: %d\n", pool->nthreads);
+
+    return pool;
+}
+
+
+/*
+ * Run @work(@arg) on a pool thread, then @done(@c, @arg) on @c's loop.
+ * @c stays allocated until @done has run, if it's closed in between
+ * @done gets NULL instead, to release @arg.
+ */
+int net_tpool_submit(net_tpool_t *pool, net_connect_t *c,
+        work_handler work, after_work_handler done, void *arg)
+{
+    net_job_t *job;
+    net_tpool_worker_t *w;
+
+    job = malloc(sizeof(net_job_t));
+    if (job == NULL)
+    {
+        logerr("job malloc failed.\n");
+        return NET_ERR;
+    }
+
+    job->conn = c;
+    job->loop = c->loop;
+    job->work = work;
+    job->done = done;
+    job->arg = arg;
+
+    c->jobs++;
+
+    w = &pool->workers[__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)
+        % pool->nthreads];
+
+    pthread_mutex_lock(&w->lock);
+    list_append(&w->jobs, &job->node);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return NET_OK;
+}
+
+
+// jobs already submitted still run, their loops must outlive this call.
+void net_tpool_destroy(net_tpool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nthreads; i++)
+    {
+        pthread_join(pool->workers[i].tid, NULL);
+    }
+
+    for (i = 0; i < pool->nthreads; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,73 @@
+#ifndef _TPOOL_H_
+#define _TPOOL_H_
+
+#include <pthread.h>
+
+#include "list.h"
+#include "net.h"
+
+/*
+ * Worker threads for blocking or CPU heavy handlers, see net_tpool_submit().
+ *
+ * Every worker owns a deque of jobs, submissions are spread over them
+ * round robin. A worker takes jobs from the head of its own deque and,
+ * once that is empty, steals from the tail of the others, so one slow
+ * job doesn't hold back the ones queued behind it. When the work is
+ * done, its completion runs on the loop of the connection it was
+ * submitted for (through net_loop_post()), never on a worker thread.
+ */
+
+typedef struct net_tpool_t net_tpool_t;
+typedef struct net_tpool_worker_t net_tpool_worker_t;
+typedef struct net_job_t net_job_t;
+
+// runs on a worker thread, must not touch the connection.
+typedef void (*work_handler)(void *);
+
+// runs on the connection's loop, conn is NULL if it closed meanwhile.
+typedef void (*after_work_handler)(net_connect_t *, void *);
+
+struct net_job_t {
+    list_t node;
+
+    net_connect_t *conn;
+    net_loop_t *loop;
+
+    work_handler work;
+    after_work_handler done;
+    void *arg;
+};
+
+struct net_tpool_worker_t {
+    pthread_t tid;
+
+    // own jobs, guarded by lock as others steal from it
+    pthread_mutex_t lock;
+    list_t jobs;
+
+    net_tpool_t *pool;
+};
+
+struct net_tpool_t {
+    int nthreads;
+    net_tpool_worker_t *workers;
+
+    // round robin submission
+    unsigned next;
+
+    // jobs in all deques, idle workers sleep on cond while there's none
+    int queued;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+net_tpool_t *net_tpool_init(int);
+int  net_tpool_submit(net_tpool_t *, net_connect_t *,
+        work_handler, after_work_handler, void *);
+void net_tpool_destroy(net_tpool_t *);
+
+// implemented in net.c
+void net_connection_free(net_connect_t *);
+
+#endif // _TPOOL_H_
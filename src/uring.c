@@ -0,0 +1,1114 @@
+#define _GNU_SOURCE
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "net.h"
+#include "uring.h"
+#include "util.h"
+
+enum uring_op {
+    URING_OP_POLL = 1,
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_CANCEL
+};
+
+/*
+ * user_data layout: op(8) | seq(24) | fd(32)
+ *
+ * @seq tells completions of a live registration apart from stale ones
+ * (fd closed and maybe reused), so no pointer is ever dereferenced
+ * after its owner is gone.
+ */
+#define URING_UDATA(op, seq, fd) \
+    (((uint64_t)(op) << 56) | ((uint64_t)((seq) & 0xffffff) << 32) | \
+     (uint32_t)(fd))
+#define URING_UD_OP(ud)  ((int)((ud) >> 56))
+#define URING_UD_SEQ(ud) ((uint32_t)(((ud) >> 32) & 0xffffff))
+#define URING_UD_FD(ud)  ((int)((ud) & 0xffffffff))
+
+typedef struct net_uring_t net_uring_t;
+
+struct net_uring_t {
+
+    int ring_fd;
+
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+    struct io_uring_sqe *sqes;
+
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    // provided buffers for multishot recv
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *bufs;
+
+    // fd -> registered io watcher
+    net_io_t **ios;
+    int ios_size;
+    uint32_t seq;
+
+    // outbufs of closed connections still referenced by in-flight sends
+    list_t zombies;
+};
+
+struct net_uring_zombie {
+    list_t node;
+    uint32_t gen;
+    int inflight;
+    list_t bufs;
+    void *send_msg;
+};
+
+// per-connection sendmsg() arguments, must outlive the request.
+struct net_uring_msg {
+    struct msghdr msg;
+    struct iovec iov[URING_SEND_BATCH];
+};
+
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+        unsigned flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter,
+            fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+
+int sys_io_uring_register(int fd, unsigned op, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, op, arg, nr_args);
+}
+
+
+uint32_t uring_next_seq(net_uring_t *r)
+{
+    r->seq = (r->seq + 1) & 0xffffff;
+    if (r->seq == 0) r->seq = 1;
+    return r->seq;
+}
+
+
+int uring_submit(net_uring_t *r, unsigned wait_nr, int timeout)
+{
+    int ret;
+    unsigned flags = 0, to_submit;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (wait_nr)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout >= 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000LL;
+
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+
+            flags |= IORING_ENTER_EXT_ARG;
+            return sys_io_uring_enter(r->ring_fd, to_submit, wait_nr,
+                    flags, &arg, sizeof(arg));
+        }
+    }
+    else if (to_submit == 0) {
+        return 0;
+    }
+
+    ret = sys_io_uring_enter(r->ring_fd, to_submit, wait_nr,
+            flags, NULL, _NSIG / 8);
+    return ret;
+}
+
+
+struct io_uring_sqe *uring_get_sqe(net_uring_t *r)
+{
+    unsigned head, idx;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries)
+    {
+        // sq full, flush it without waiting.
+        if (uring_submit(r, 0, -1) < 0)
+        {
+            logerr("io_uring submit failed: %s\n", strerror(errno));
+        }
+
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sqe_tail - head >= r->sq_entries)
+        {
+            logerr("io_uring sq overflow.\n");
+            return NULL;
+        }
+    }
+
+    idx = r->sqe_tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqe_tail++;
+
+    return sqe;
+}
+
+
+void uring_recycle_buf(net_uring_t *r, int bid)
+{
+    struct io_uring_buf *b;
+    unsigned short tail = r->buf_ring->tail;
+
+    b = &r->buf_ring->bufs[tail & (URING_BUF_CNT - 1)];
+    b->addr = (uint64_t)(uintptr_t)(r->bufs + bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = bid;
+
+    __atomic_store_n(&r->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+int uring_setup_bufs(net_uring_t *r)
+{
+    int i;
+    struct io_uring_buf_reg reg;
+
+    r->buf_ring_size = URING_BUF_CNT * sizeof(struct io_uring_buf);
+    r->buf_ring = mmap(NULL, r->buf_ring_size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (r->buf_ring == MAP_FAILED)
+    {
+        r->buf_ring = NULL;
+        return -1;
+    }
+
+    r->bufs = malloc(URING_BUF_CNT * URING_BUF_SIZE);
+    if (r->bufs == NULL) return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+    reg.ring_entries = URING_BUF_CNT;
+    reg.bgid = URING_BUF_GROUP;
+
+    if (sys_io_uring_register(r->ring_fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        logerr("io_uring register buf ring failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    r->buf_ring->tail = 0;
+    for (i = 0; i < URING_BUF_CNT; i++)
+    {
+        uring_recycle_buf(r, i);
+    }
+
+    return 0;
+}
+
+
+void uring_free(net_uring_t *r)
+{
+    if (r->buf_ring) munmap(r->buf_ring, r->buf_ring_size);
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->ring_fd >= 0) close(r->ring_fd);
+
+    free(r->bufs);
+    free(r->ios);
+    free(r);
+}
+
+
+int net_uring_init(net_loop_t *loop)
+{
+    unsigned i;
+    net_uring_t *r;
+    struct io_uring_params p;
+
+    r = calloc(1, sizeof(net_uring_t));
+    if (r == NULL)
+    {
+        logerr("io_uring malloc failed.\n");
+        return NET_ERR;
+    }
+    list_init(&r->zombies);
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    r->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (r->ring_fd < 0)
+    {
+        // older kernel, retry without optional flags.
+        memset(&p, 0, sizeof(p));
+        r->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    }
+    if (r->ring_fd < 0)
+    {
+        logerr("io_uring_setup failed: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        logerr("io_uring lacks EXT_ARG support.\n");
+        goto fail;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+    {
+        r->sq_ring = NULL;
+        logerr("io_uring mmap sq failed: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->cq_ring = r->sq_ring;
+    }
+    else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+        {
+            r->cq_ring = NULL;
+            logerr("io_uring mmap cq failed: %s\n", strerror(errno));
+            goto fail;
+        }
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes = NULL;
+        logerr("io_uring mmap sqes failed: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    r->sq_head = r->sq_ring + p.sq_off.head;
+    r->sq_tail = r->sq_ring + p.sq_off.tail;
+    r->sq_mask = r->sq_ring + p.sq_off.ring_mask;
+    r->sq_array = r->sq_ring + p.sq_off.array;
+    r->sq_entries = p.sq_entries;
+    r->sqe_tail = *r->sq_tail;
+
+    r->cq_head = r->cq_ring + p.cq_off.head;
+    r->cq_tail = r->cq_ring + p.cq_off.tail;
+    r->cq_mask = r->cq_ring + p.cq_off.ring_mask;
+    r->cqes = r->cq_ring + p.cq_off.cqes;
+
+    // sqe index i always lives in sq slot i.
+    for (i = 0; i < r->sq_entries; i++) r->sq_array[i] = i;
+
+    if (uring_setup_bufs(r)) goto fail;
+
+    loop->uring = r;
+    logdebug("io_uring init succ, fd: %d\n", r->ring_fd);
+
+    return NET_OK;
+
+fail:
+    uring_free(r);
+    return NET_ERR;
+}
+
+
+void net_uring_destroy(net_loop_t *loop)
+{
+    list_t *node, *node_next, *b, *b_next;
+    struct net_uring_zombie *z;
+    net_uring_t *r = loop->uring;
+
+    if (r == NULL) return;
+
+    LIST_FOR_EACH_SAFE(&r->zombies, node, node_next)
+    {
+        z = container_of(node, struct net_uring_zombie, node);
+        LIST_FOR_EACH_SAFE(&z->bufs, b, b_next)
+        {
+            net_buf_del(container_of(b, net_buf_t, node));
+        }
+        free(z->send_msg);
+        free(z);
+    }
+
+    uring_free(r);
+    loop->uring = NULL;
+}
+
+
+// bind @w to its fd slot, completions are matched against w->gen.
+void uring_register(net_uring_t *r, net_io_t *w)
+{
+    int size;
+    net_io_t **ios;
+
+    if (w->fd >= r->ios_size)
+    {
+        size = r->ios_size ? r->ios_size : 1024;
+        while (size <= w->fd) size *= 2;
+
+        ios = realloc(r->ios, size * sizeof(net_io_t *));
+        if (ios == NULL)
+        {
+            logerr("io_uring fd table realloc failed.\n");
+            return;
+        }
+        memset(ios + r->ios_size, 0,
+                (size - r->ios_size) * sizeof(net_io_t *));
+
+        r->ios = ios;
+        r->ios_size = size;
+    }
+
+    if (r->ios[w->fd] != w)
+    {
+        r->ios[w->fd] = w;
+        w->gen = uring_next_seq(r);
+    }
+}
+
+
+net_io_t *uring_lookup(net_uring_t *r, int fd, uint32_t gen)
+{
+    net_io_t *w;
+
+    if (fd < 0 || fd >= r->ios_size) return NULL;
+
+    w = r->ios[fd];
+    if (w && w->gen == gen) return w;
+
+    return NULL;
+}
+
+
+void uring_cancel(net_uring_t *r, uint64_t user_data, int all)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (sqe == NULL) return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->cancel_flags = all ? IORING_ASYNC_CANCEL_ALL : 0;
+    sqe->user_data = URING_UDATA(URING_OP_CANCEL, 0, 0);
+}
+
+
+void uring_poll_remove(net_uring_t *r, net_io_t *w)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!w->poll_mask) return;
+
+    sqe = uring_get_sqe(r);
+    if (sqe == NULL) return;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = URING_UDATA(URING_OP_POLL, w->poll_seq, w->fd);
+    sqe->user_data = URING_UDATA(URING_OP_CANCEL, 0, 0);
+
+    w->poll_mask = 0;
+}
+
+
+void uring_poll_add(net_uring_t *r, net_io_t *w, uint32_t mask)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (sqe == NULL) return;
+
+    uring_register(r, w);
+    w->poll_seq = uring_next_seq(r);
+    w->poll_mask = mask;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = w->fd;
+    sqe->poll32_events = mask;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_UDATA(URING_OP_POLL, w->poll_seq, w->fd);
+}
+
+
+// sync the multishot poll of @w with its reading/writing state.
+void net_uring_poll_update(net_loop_t *loop, net_io_t *w)
+{
+    uint32_t mask = 0;
+    net_uring_t *r = loop->uring;
+
+    if (w->reading && !w->uring_recv) mask |= POLLIN | POLLRDHUP;
+    if (w->writing) mask |= POLLOUT;
+
+    if (mask == w->poll_mask) return;
+
+    uring_poll_remove(r, w);
+    if (mask) uring_poll_add(r, w, mask);
+}
+
+
+void net_uring_forget(net_loop_t *loop, net_io_t *w)
+{
+    net_uring_t *r = loop->uring;
+
+    uring_poll_remove(r, w);
+
+    if (w->uring_recv)
+    {
+        uring_cancel(r, URING_UDATA(URING_OP_RECV, w->gen, w->fd), 0);
+        w->uring_recv = 0;
+    }
+
+    if (w->uring_accept)
+    {
+        uring_cancel(r, URING_UDATA(URING_OP_ACCEPT, w->gen, w->fd), 0);
+        w->uring_accept = 0;
+    }
+
+    if (w->fd >= 0 && w->fd < r->ios_size && r->ios[w->fd] == w)
+    {
+        r->ios[w->fd] = NULL;
+    }
+}
+
+
+void net_uring_accept(net_connect_t *c)
+{
+    net_io_t *w = &c->io_watcher;
+    net_uring_t *r = c->loop->uring;
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+    if (sqe == NULL) return;
+
+    uring_register(r, w);
+    w->alive = 1;
+    w->uring_accept = 1;
+    w->uring_accepted = 0;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = w->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = URING_UDATA(URING_OP_ACCEPT, w->gen, w->fd);
+}
+
+
+void net_uring_recv_start(net_connect_t *c)
+{
+    net_io_t *w = &c->io_watcher;
+    net_uring_t *r = c->loop->uring;
+    struct io_uring_sqe *sqe;
+
+    w->reading = 1;
+    if (w->uring_recv) return;
+
+    sqe = uring_get_sqe(r);
+    if (sqe == NULL) return;
+
+    uring_register(r, w);
+    w->alive = 1;
+    w->uring_recv = 1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = w->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = URING_UDATA(URING_OP_RECV, w->gen, w->fd);
+
+    // drop any POLLIN left from before.
+    net_uring_poll_update(c->loop, w);
+}
+
+
+void net_uring_recv_stop(net_connect_t *c)
+{
+    net_io_t *w = &c->io_watcher;
+    net_uring_t *r = c->loop->uring;
+
+    w->reading = 0;
+    if (!w->uring_recv) return;
+
+    uring_cancel(r, URING_UDATA(URING_OP_RECV, w->gen, w->fd), 0);
+    w->uring_recv = 0;
+}
+
+
+/*
+ * No sendfile opcode, a file segment at outbuf head is pushed with a
+ * plain nonblocking sendfile(), still without copying it to user space.
+ */
+void uring_sendfile(net_connect_t *c, net_buf_t *b)
+{
+    ssize_t n;
+
+    n = net_buf_sendfile(c, b);
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            c->on_write = net_connection_send;
+            net_io_start(c->loop, &c->io_watcher, NET_EV_WRITE);
+        }
+        else {
+            logerr("[conn: %p, fd: %d] sendfile error: %s\n",
+                    c, c->io_watcher.fd, strerror(errno));
+            c->err = 1;
+        }
+        return;
+    }
+
+    logdebug("[conn: %p, fd: %d] sendfile data, size: %ld\n",
+            c, c->io_watcher.fd, n);
+    net_connection_active(c, 1);
+
+    b->consume += n;
+    if (b->consume == b->pos) net_buf_del(b);
+    net_connection_sent(c, n);
+
+    // next segment, or EAGAIN if the socket buffer is full by now.
+    net_uring_send(c);
+}
+
+
+/*
+ * Gather outbuf into a single sendmsg, like writev() for epoll. Only one
+ * send per connection is in flight, a short send leaves the rest in
+ * outbuf for the next one, so data never goes out of order. Data
+ * appended meanwhile is sent with the next one.
+ */
+void net_uring_send(net_connect_t *c)
+{
+    int n = 0;
+    list_t *node, *node_next;
+    net_buf_t *output;
+    net_io_t *w = &c->io_watcher;
+    net_uring_t *r = c->loop->uring;
+    struct net_uring_msg *m;
+    struct io_uring_sqe *sqe;
+
+    if (c->connecting || c->send_inflight || c->err) return;
+
+    if (c->send_msg == NULL)
+    {
+        c->send_msg = malloc(sizeof(struct net_uring_msg));
+        if (c->send_msg == NULL)
+        {
+            logerr("io_uring sendmsg malloc failed.\n");
+            c->err = 1;
+            return;
+        }
+    }
+    m = c->send_msg;
+
+    LIST_FOR_EACH_SAFE(&c->outbuf, node, node_next)
+    {
+        output = container_of(node, net_buf_t, node);
+
+        if (output->pos == output->consume)
+        {
+            net_buf_del(output);
+            continue;
+        }
+
+        if (n == URING_SEND_BATCH) break;
+
+        // file segments go out on their own, see uring_sendfile().
+        if (net_buf_is_file(output))
+        {
+            if (n == 0)
+            {
+                uring_sendfile(c, output);
+                return;
+            }
+            break;
+        }
+
+        m->iov[n].iov_base = output->buf + output->consume;
+        m->iov[n].iov_len = output->pos - output->consume;
+        n++;
+    }
+
+    if (n == 0)
+    {
+        net_connection_send_done(c);
+        return;
+    }
+
+    sqe = uring_get_sqe(r);
+    if (sqe == NULL)
+    {
+        // no sqe left, retry once writable.
+        c->on_write = net_connection_send;
+        net_io_start(c->loop, w, NET_EV_WRITE);
+        return;
+    }
+
+    uring_register(r, w);
+
+    memset(&m->msg, 0, sizeof(struct msghdr));
+    m->msg.msg_iov = m->iov;
+    m->msg.msg_iovlen = n;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = w->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&m->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_UDATA(URING_OP_SEND, w->gen, w->fd);
+
+    c->send_inflight = 1;
+}
+
+
+// @c is closing with sends in flight, keep their buffers until completion.
+void net_uring_bury(net_connect_t *c)
+{
+    list_t *node, *node_next;
+    net_io_t *w = &c->io_watcher;
+    net_uring_t *r = c->loop->uring;
+    struct net_uring_zombie *z;
+
+    if (c->send_inflight == 0)
+    {
+        free(c->send_msg);
+        c->send_msg = NULL;
+        return;
+    }
+
+    z = malloc(sizeof(struct net_uring_zombie));
+    if (z == NULL)
+    {
+        logerr("io_uring zombie malloc failed.\n");
+        return;
+    }
+
+    z->gen = w->gen;
+    z->inflight = c->send_inflight;
+    z->send_msg = c->send_msg;
+    list_init(&z->bufs);
+
+    LIST_FOR_EACH_SAFE(&c->outbuf, node, node_next)
+    {
+        list_del(node);
+        list_append(&z->bufs, node);
+    }
+    list_append(&r->zombies, &z->node);
+
+    uring_cancel(r, URING_UDATA(URING_OP_SEND, w->gen, w->fd), 1);
+    c->send_inflight = 0;
+    c->send_msg = NULL;
+}
+
+
+void uring_zombie_reap(net_uring_t *r, uint32_t gen)
+{
+    list_t *node, *b, *b_next;
+    struct net_uring_zombie *z;
+
+    LIST_FOR_EACH(&r->zombies, node)
+    {
+        z = container_of(node, struct net_uring_zombie, node);
+        if (z->gen != gen) continue;
+
+        if (--z->inflight == 0)
+        {
+            LIST_FOR_EACH_SAFE(&z->bufs, b, b_next)
+            {
+                net_buf_del(container_of(b, net_buf_t, node));
+            }
+            list_del(&z->node);
+            free(z->send_msg);
+            free(z);
+        }
+        return;
+    }
+}
+
+
+void uring_on_poll(net_uring_t *r, net_io_t *w, struct io_uring_cqe *cqe)
+{
+    if (w->poll_seq != URING_UD_SEQ(cqe->user_data)) return;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        // poll terminated by the kernel, re-arm if still wanted.
+        uint32_t mask = w->poll_mask;
+        w->poll_mask = 0;
+        if (cqe->res != -ECANCELED && mask) uring_poll_add(r, w, mask);
+    }
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res != -ECANCELED)
+        {
+            logerr("[fd: %d] io_uring poll failed: %s\n",
+                    w->fd, strerror(-cqe->res));
+        }
+        return;
+    }
+
+    w->events = cqe->res;
+    w->cb(w);
+}
+
+
+// @fd was accepted past the budget, keep it for a later round.
+int uring_accept_defer(net_connect_t *c, int fd)
+{
+    int size, *fds;
+    net_server_t *s = c->server;
+
+    if (s->accept_nfds == s->accept_fds_size)
+    {
+        size = s->accept_fds_size ? s->accept_fds_size * 2 : 64;
+        fds = realloc(s->accept_fds, size * sizeof(int));
+        if (fds == NULL)
+        {
+            logerr("accept backlog realloc failed.\n");
+            return NET_ERR;
+        }
+        s->accept_fds = fds;
+        s->accept_fds_size = size;
+    }
+
+    s->accept_fds[s->accept_nfds++] = fd;
+    c->io_watcher.events = POLLIN;
+    net_io_post(c->loop, &c->io_watcher);
+
+    return NET_OK;
+}
+
+
+/*
+ * Set up connections accepted past the budget of an earlier round, a
+ * budget's worth at a time. The multishot accept stopped by the budget
+ * is armed again once they are all taken.
+ */
+void net_uring_accept_backlog(net_connect_t *c)
+{
+    int i, n, budget = c->server->accept_budget;
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    net_server_t *s = c->server;
+    net_io_t *w = &c->io_watcher;
+
+    n = s->accept_nfds;
+    if (budget > 0 && n > budget) n = budget;
+
+    for (i = 0; i < n; i++)
+    {
+        addr_len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        getpeername(s->accept_fds[i], (struct sockaddr *)&addr, &addr_len);
+
+        net_accept_connection(c, s->accept_fds[i], &addr);
+    }
+
+    s->accept_nfds -= n;
+    memmove(s->accept_fds, s->accept_fds + n, s->accept_nfds * sizeof(int));
+
+    if (s->accept_nfds)
+    {
+        logdebug("accept budget used up, continue next round.\n");
+        w->events = POLLIN;
+        net_io_post(c->loop, w);
+    }
+    else if (!w->uring_accept) {
+        net_uring_accept(c);
+    }
+}
+
+
+void uring_on_accept(net_uring_t *r, net_io_t *w, struct io_uring_cqe *cqe)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    net_connect_t *c = container_of(w, net_connect_t, io_watcher);
+    int budget = c->server->accept_budget;
+
+    // ended by an error or by the budget below, arm it again unless
+    // connections accepted meanwhile still wait, see above.
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        w->uring_accept = 0;
+        if (c->server->accept_nfds == 0) net_uring_accept(c);
+    }
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res != -ECANCELED)
+        {
+            logerr("accept failed: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    /* Budget used up, stop the multishot. Whatever the kernel accepted
+     * before the cancel takes effect is set up in later rounds. */
+    if (budget > 0 && w->uring_accepted >= budget)
+    {
+        if (uring_accept_defer(c, cqe->res) != NET_OK) close(cqe->res);
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    getpeername(cqe->res, (struct sockaddr *)&addr, &addr_len);
+
+    net_accept_connection(c, cqe->res, &addr);
+
+    if (++w->uring_accepted == budget)
+    {
+        logdebug("accept budget used up, continue next round.\n");
+        uring_cancel(r, URING_UDATA(URING_OP_ACCEPT, w->gen, w->fd), 0);
+    }
+}
+
+
+void uring_on_recv(net_uring_t *r, net_io_t *w, struct io_uring_cqe *cqe)
+{
+    int bid = -1;
+    net_connect_t *c = container_of(w, net_connect_t, io_watcher);
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    }
+
+    // a cancelled one was already dropped by net_uring_recv_stop(), and
+    // may have been replaced by a fresh recv since.
+    if (!(cqe->flags & IORING_CQE_F_MORE) && cqe->res != -ECANCELED)
+    {
+        // multishot ended (buffers ran out), re-arm.
+        w->uring_recv = 0;
+        if (w->reading && cqe->res != 0)
+        {
+            if (cqe->res > 0 || cqe->res == -ENOBUFS)
+                net_uring_recv_start(c);
+        }
+    }
+
+    if (cqe->res > 0)
+    {
+        logdebug("[conn: %p, fd: %d] recv data, size: %d\n",
+                c, w->fd, cqe->res);
+        net_connection_feed(c, r->bufs + bid * URING_BUF_SIZE, cqe->res);
+    }
+    else if (cqe->res == 0)
+    {
+        logdebug("[conn: %p, fd: %d] recv 0, closing connection.\n",
+                c, w->fd);
+        net_connection_close(c);
+    }
+    else if (cqe->res != -ECANCELED && cqe->res != -ENOBUFS)
+    {
+        logerr("[conn: %p, fd: %d] recv error: %s\n",
+                c, w->fd, strerror(-cqe->res));
+        c->err = 1;
+        net_connection_close(c);
+    }
+
+    if (bid >= 0) uring_recycle_buf(r, bid);
+}
+
+
+void uring_on_send(net_uring_t *r, net_io_t *w, struct io_uring_cqe *cqe)
+{
+    int n, left;
+    list_t *node, *node_next;
+    net_buf_t *output;
+    net_connect_t *c = container_of(w, net_connect_t, io_watcher);
+
+    c->send_inflight--;
+
+    if (cqe->res > 0)
+    {
+        logdebug("[conn: %p, fd: %d] send data, size: %d\n",
+                c, w->fd, cqe->res);
+        net_connection_active(c, 1);
+
+        // release what has been sent, partial one stays at head.
+        n = cqe->res;
+        LIST_FOR_EACH_SAFE(&c->outbuf, node, node_next)
+        {
+            output = container_of(node, net_buf_t, node);
+            left = output->pos - output->consume;
+            if (n < left)
+            {
+                output->consume += n;
+                break;
+            }
+            n -= left;
+            net_buf_del(output);
+        }
+        net_connection_sent(c, cqe->res);
+    }
+    else if (cqe->res == -EAGAIN) {
+        c->send_blocked = 1;
+    }
+    else if (cqe->res != -ECANCELED) {
+        logerr("[conn: %p, fd: %d] write error: %s\n",
+                c, w->fd, strerror(-cqe->res));
+        c->err = 1;
+    }
+
+    if (c->send_inflight) return;
+
+    if (c->err)
+    {
+        net_connection_should_close(c);
+        return;
+    }
+
+    if (c->send_blocked)
+    {
+        // socket buffer full, wait for POLLOUT then send again.
+        c->send_blocked = 0;
+        c->on_write = net_connection_send;
+        net_io_start(c->loop, w, NET_EV_WRITE);
+        return;
+    }
+
+    net_uring_send(c);
+    if (c->send_inflight == 0) net_connection_should_close(c);
+}
+
+
+void uring_dispatch(net_loop_t *loop, struct io_uring_cqe *cqe)
+{
+    net_io_t *w;
+    net_uring_t *r = loop->uring;
+    int op = URING_UD_OP(cqe->user_data);
+    uint32_t seq = URING_UD_SEQ(cqe->user_data);
+    int fd = URING_UD_FD(cqe->user_data);
+
+    if (op == URING_OP_CANCEL) return;
+
+    if (op == URING_OP_POLL)
+    {
+        if (fd >= 0 && fd < r->ios_size && r->ios[fd])
+        {
+            uring_on_poll(r, r->ios[fd], cqe);
+        }
+        return;
+    }
+
+    w = uring_lookup(r, fd, seq);
+    if (w == NULL)
+    {
+        // owner already gone.
+        if (op == URING_OP_RECV && (cqe->flags & IORING_CQE_F_BUFFER))
+        {
+            uring_recycle_buf(r, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        else if (op == URING_OP_ACCEPT && cqe->res >= 0) {
+            close(cqe->res);
+        }
+        else if (op == URING_OP_SEND) {
+            uring_zombie_reap(r, seq);
+        }
+        return;
+    }
+
+    switch (op)
+    {
+        case URING_OP_ACCEPT:
+            uring_on_accept(r, w, cqe);
+            break;
+        case URING_OP_RECV:
+            uring_on_recv(r, w, cqe);
+            break;
+        case URING_OP_SEND:
+            uring_on_send(r, w, cqe);
+            break;
+        default:
+            logerr("unknown io_uring op: %d\n", op);
+    }
+}
+
+
+/* submit everything queued, wait up to @timeout ms, dispatch completions. */
+int net_uring_wait(net_loop_t *loop, int timeout)
+{
+    int n = 0;
+    unsigned head, tail;
+    struct io_uring_cqe cqe;
+    net_uring_t *r = loop->uring;
+
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (uring_submit(r, head == tail ? 1 : 0, timeout) < 0)
+    {
+        if (errno != ETIME && errno != EINTR && errno != EBUSY)
+        {
+            logerr("io_uring_enter failed: %s\n", strerror(errno));
+        }
+    }
+
+    while (1)
+    {
+        head = *r->cq_head;
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) break;
+
+        // copy out and release the slot first, handlers may queue more.
+        cqe = r->cqes[head & *r->cq_mask];
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        uring_dispatch(loop, &cqe);
+        n++;
+    }
+
+    return n;
+}
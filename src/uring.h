@@ -0,0 +1,47 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include "net.h"
+
+/*
+ * io_uring engine for net_loop_t, selected by net_loop_engine().
+ *
+ * Plain fds (timers, connecting clients, writable waits) are driven by
+ * multishot poll, so net_io_t callbacks behave as with epoll. Listening
+ * sockets use multishot accept, established connections receive through
+ * multishot recv on a ring of provided buffers and send outbuf gathered
+ * into one sendmsg. Everything queued during one loop iteration is
+ * submitted by the single io_uring_enter() that waits for completions.
+ */
+
+#define URING_ENTRIES  1024
+#define URING_BUF_CNT  256
+#define URING_BUF_SIZE 4096
+#define URING_BUF_GROUP 0
+#define URING_SEND_BATCH 64
+
+int  net_uring_init(net_loop_t *);
+void net_uring_destroy(net_loop_t *);
+int  net_uring_wait(net_loop_t *, int);
+
+void net_uring_poll_update(net_loop_t *, net_io_t *);
+void net_uring_forget(net_loop_t *, net_io_t *);
+void net_uring_accept(net_connect_t *);
+void net_uring_accept_backlog(net_connect_t *);
+void net_uring_recv_start(net_connect_t *);
+void net_uring_recv_stop(net_connect_t *);
+void net_uring_send(net_connect_t *);
+void net_uring_bury(net_connect_t *);
+
+// implemented in net.c, invoked on completions.
+void net_io_start(net_loop_t *, net_io_t *, enum event_type);
+void net_io_post(net_loop_t *, net_io_t *);
+int  net_connection_should_close(net_connect_t *);
+void net_connection_feed(net_connect_t *, const char *, int);
+void net_connection_send_done(net_connect_t *);
+void net_connection_active(net_connect_t *, int);
+void net_connection_sent(net_connect_t *, size_t);
+ssize_t net_buf_sendfile(net_connect_t *, net_buf_t *);
+void net_accept_connection(net_connect_t *, int, struct sockaddr_in *);
+
+#endif // _URING_H_
@@ -5,6 +5,13 @@
 #include <unistd.h>
 #include <sys/syscall.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTIL_SCAN_X86
+#endif
+
+#include "util.h"
+
 extern int log_level;
 
 int _log(int level, int fd, const char *fmt, ...)
@@ -95,3 +102,121 @@ char *util_strstr(char *haystack, char *needle, int len)
 
     return matched;
 }
+
+
+/*
+ * util_scan(): first byte of @s[0, len) equal to @a, @b or @c, NULL if
+ * there's none. Vectorized 32 (AVX2) or 16 (SSE2) bytes at a time where
+ * the cpu allows, the tail and other archs go byte by byte. It never
+ * reads past @s + len.
+ */
+typedef char *(*util_scan_fn)(const char *, int, int, int, int);
+
+util_scan_fn util_scan_impl;
+
+
+char *util_scan_scalar(const char *s, int len, int a, int b, int c)
+{
+    const char *end = s + len;
+
+    for (; s < end; s++)
+    {
+        if (*s == a || *s == b || *s == c) return (char *)s;
+    }
+
+    return NULL;
+}
+
+
+#ifdef UTIL_SCAN_X86
+__attribute__((target("sse2")))
+char *util_scan_sse2(const char *s, int len, int a, int b, int c)
+{
+    unsigned mask;
+    const char *end = s + len;
+    __m128i v, va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b),
+            vc = _mm_set1_epi8(c);
+
+    for (; end - s >= 16; s += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)s);
+        mask = _mm_movemask_epi8(_mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                    _mm_cmpeq_epi8(v, vc)));
+        if (mask) return (char *)s + __builtin_ctz(mask);
+    }
+
+    return util_scan_scalar(s, end - s, a, b, c);
+}
+
+
+__attribute__((target("avx2")))
+char *util_scan_avx2(const char *s, int len, int a, int b, int c)
+{
+    unsigned mask;
+    const char *end = s + len;
+    __m256i v, va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b),
+            vc = _mm256_set1_epi8(c);
+
+    for (; end - s >= 32; s += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)s);
+        mask = _mm256_movemask_epi8(_mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                        _mm256_cmpeq_epi8(v, vb)),
+                    _mm256_cmpeq_epi8(v, vc)));
+        if (mask) return (char *)s + __builtin_ctz(mask);
+    }
+
+    // gcc turns the call below into a jump without vzeroupper, and
+    // legacy SSE code after dirty ymm state is very slow.
+    _mm256_zeroupper();
+    return util_scan_sse2(s, end - s, a, b, c);
+}
+#endif
+
+
+/* pick the widest util_scan() the cpu runs, or force @level (one of
+ * UTIL_SCAN_*, -1 for the best), return the level in use. */
+int util_scan_level(int level)
+{
+    int best = UTIL_SCAN_SCALAR;
+
+#ifdef UTIL_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) best = UTIL_SCAN_SSE2;
+    if (__builtin_cpu_supports("avx2")) best = UTIL_SCAN_AVX2;
+#endif
+
+    if (level < 0 || level > best) level = best;
+
+    switch (level)
+    {
+#ifdef UTIL_SCAN_X86
+        case UTIL_SCAN_AVX2:
+            util_scan_impl = util_scan_avx2;
+            break;
+        case UTIL_SCAN_SSE2:
+            util_scan_impl = util_scan_sse2;
+            break;
+#endif
+        default:
+            util_scan_impl = util_scan_scalar;
+            level = UTIL_SCAN_SCALAR;
+    }
+
+    return level;
+}
+
+
+__attribute__((constructor))
+void util_scan_init(void)
+{
+    util_scan_level(-1);
+}
+
+
+char *util_scan(const char *s, int len, int a, int b, int c)
+{
+    return util_scan_impl(s, len, a, b, c);
+}
@@ -21,4 +21,12 @@ int _log(int level, int fd, const char *fmt, ...);
 char *util_strstr(char *haystack, char *needle, int len);
 char *util_strchr(const char *s, int c, int len);
 
+// vectorized search for any of 3 bytes, see util_scan_level()
+#define UTIL_SCAN_SCALAR 0
+#define UTIL_SCAN_SSE2   1
+#define UTIL_SCAN_AVX2   2
+
+char *util_scan(const char *s, int len, int a, int b, int c);
+int util_scan_level(int level);
+
 #endif
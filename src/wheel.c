@@ -0,0 +1,302 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include "net.h"
+#include "wheel.h"
+#include "util.h"
+
+#define WHEEL_ROOT_SIZE  (1 << WHEEL_ROOT_BITS)
+#define WHEEL_ROOT_MASK  (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+
+// bit offset of upper level @n (1 based) within a tick count
+#define WHEEL_SHIFT(n) (WHEEL_ROOT_BITS + ((n) - 1) * WHEEL_LEVEL_BITS)
+
+// farthest expiry the wheel holds, later ones are parked at the top.
+#define WHEEL_MAX_SPAN (((uint64_t)1 << WHEEL_SHIFT(WHEEL_LEVELS + 1)) - 1)
+
+typedef struct net_wheel_t net_wheel_t;
+
+struct net_wheel_t {
+
+    // next tick (ms) to run, every earlier one is done
+    uint64_t now;
+
+    // when the loop has to run the wheel next, 0 if never
+    uint64_t deadline;
+
+    int cnt;
+    int root_cnt;
+
+    list_t root[WHEEL_ROOT_SIZE];
+    list_t levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+
+    net_loop_t *loop;
+};
+
+
+uint64_t net_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+void wheel_place(net_wheel_t *w, net_timer_t *t)
+{
+    int n;
+    uint64_t delta, expire = t->expire;
+
+    // already due, run on next tick
+    if (expire < w->now) expire = w->now;
+    delta = expire - w->now;
+
+    if (delta < WHEEL_ROOT_SIZE)
+    {
+        list_append(&w->root[expire & WHEEL_ROOT_MASK], &t->node);
+        t->level = 0;
+        w->root_cnt++;
+        return;
+    }
+
+    if (delta > WHEEL_MAX_SPAN)
+    {
+        expire = w->now + WHEEL_MAX_SPAN;
+        delta = WHEEL_MAX_SPAN;
+    }
+
+    for (n = 1; n < WHEEL_LEVELS; n++)
+    {
+        if (delta < (uint64_t)1 << WHEEL_SHIFT(n + 1)) break;
+    }
+
+    list_append(&w->levels[n - 1][(expire >> WHEEL_SHIFT(n)) & WHEEL_LEVEL_MASK],
+            &t->node);
+    t->level = n;
+}
+
+
+void wheel_unlink(net_wheel_t *w, net_timer_t *t)
+{
+    list_del(&t->node);
+    if (t->level == 0) w->root_cnt--;
+    t->level = -1;
+    w->cnt--;
+}
+
+
+// move timers of slot @idx at level @n one level down, return @idx.
+int wheel_cascade(net_wheel_t *w, int n, int idx)
+{
+    list_t pending;
+    net_timer_t *t;
+
+    list_init(&pending);
+    list_splice(&pending, &w->levels[n - 1][idx]);
+
+    while (!list_empty(&pending))
+    {
+        t = container_of(pending.next, net_timer_t, node);
+        list_del(&t->node);
+        wheel_place(w, t);
+    }
+
+    return idx;
+}
+
+
+// earliest tick the wheel needs to run, 0 if it's empty.
+uint64_t wheel_next(net_wheel_t *w)
+{
+    int n, i, from;
+    uint64_t block, when, next = 0;
+
+    if (w->cnt == 0) return 0;
+
+    for (i = 0; w->root_cnt && i < WHEEL_ROOT_SIZE; i++)
+    {
+        if (!list_empty(&w->root[(w->now + i) & WHEEL_ROOT_MASK]))
+        {
+            next = w->now + i;
+            break;
+        }
+    }
+
+    // upper slots must cascade in time, wake up for the first occupied one.
+    for (n = 1; n <= WHEEL_LEVELS; n++)
+    {
+        block = w->now >> WHEEL_SHIFT(n);
+        from = (w->now & (((uint64_t)1 << WHEEL_SHIFT(n)) - 1)) ? 1 : 0;
+
+        for (i = from; i <= WHEEL_LEVEL_SIZE; i++)
+        {
+            if (list_empty(&w->levels[n - 1][(block + i) & WHEEL_LEVEL_MASK]))
+                continue;
+
+            when = (block + i) << WHEEL_SHIFT(n);
+            if (next == 0 || when < next) next = when;
+            break;
+        }
+    }
+
+    return next;
+}
+
+
+// run every tick up to @target (ms).
+void wheel_run(net_wheel_t *w, uint64_t target)
+{
+    int n, idx;
+    list_t expired;
+    net_timer_t *t;
+
+    while (w->now <= target)
+    {
+        idx = w->now & WHEEL_ROOT_MASK;
+
+        if (idx == 0)
+        {
+            for (n = 1; n <= WHEEL_LEVELS; n++)
+            {
+                if (wheel_cascade(w, n,
+                        (w->now >> WHEEL_SHIFT(n)) & WHEEL_LEVEL_MASK)) break;
+            }
+        }
+
+        if (w->root_cnt == 0)
+        {
+            // nothing due in this round, skip to its end.
+            w->now = (w->now | WHEEL_ROOT_MASK) + 1;
+            if (w->now > target + 1) w->now = target + 1;
+            continue;
+        }
+
+        list_init(&expired);
+        list_splice(&expired, &w->root[idx]);
+        w->now++;
+
+        while (!list_empty(&expired))
+        {
+            t = container_of(expired.next, net_timer_t, node);
+            wheel_unlink(w, t);
+
+            if (t->interval > 0)
+            {
+                // collapse missed periods, like timerfd does.
+                t->expire += t->interval;
+                if (t->expire <= target) t->expire = target + t->interval;
+                wheel_place(w, t);
+                w->cnt++;
+            }
+
+            // callback may reset, stop or free @t.
+            if (t->timer_cb) t->timer_cb(t);
+        }
+    }
+}
+
+
+// run timers due by now, called by the loop after every wait.
+void net_wheel_expire(net_loop_t *loop)
+{
+    uint64_t now;
+    net_wheel_t *w = loop->wheel;
+
+    if (w == NULL || w->deadline == 0) return;
+
+    now = net_time_ms();
+    if (now < w->deadline) return;
+
+    wheel_run(w, now);
+    w->deadline = wheel_next(w);
+}
+
+
+// ms the loop may sleep before the wheel needs to run, -1 if forever.
+int net_wheel_timeout(net_loop_t *loop)
+{
+    uint64_t now;
+    net_wheel_t *w = loop->wheel;
+
+    if (w == NULL || w->deadline == 0) return -1;
+
+    now = net_time_ms();
+    if (w->deadline <= now) return 0;
+    if (w->deadline - now > INT_MAX) return INT_MAX;
+
+    return w->deadline - now;
+}
+
+
+net_wheel_t *wheel_get(net_loop_t *loop)
+{
+    int i, j;
+    net_wheel_t *w = loop->wheel;
+
+    if (w) return w;
+
+    w = calloc(1, sizeof(net_wheel_t));
+    if (w == NULL)
+    {
+        logerr("wheel calloc failed.\n");
+        return NULL;
+    }
+
+    for (i = 0; i < WHEEL_ROOT_SIZE; i++) list_init(&w->root[i]);
+    for (i = 0; i < WHEEL_LEVELS; i++)
+    {
+        for (j = 0; j < WHEEL_LEVEL_SIZE; j++) list_init(&w->levels[i][j]);
+    }
+
+    w->now = net_time_ms();
+    w->loop = loop;
+
+    loop->wheel = w;
+    return w;
+}
+
+
+// @t->expire (ms, CLOCK_MONOTONIC) must be set.
+void net_wheel_add(net_loop_t *loop, net_timer_t *t)
+{
+    uint64_t expire;
+    net_wheel_t *w = wheel_get(loop);
+
+    if (w == NULL) return;
+    if (t->level >= 0) wheel_unlink(w, t);
+
+    // nothing pending, no need to walk the idle period.
+    if (w->cnt == 0) w->now = net_time_ms();
+
+    wheel_place(w, t);
+    w->cnt++;
+
+    expire = t->expire < w->now ? w->now : t->expire;
+    if (w->deadline == 0 || expire < w->deadline) w->deadline = expire;
+}
+
+
+void net_wheel_del(net_loop_t *loop, net_timer_t *t)
+{
+    net_wheel_t *w = loop->wheel;
+
+    // a stale deadline only costs a spurious wakeup, leave it.
+    if (w && t->level >= 0) wheel_unlink(w, t);
+}
+
+
+// pending timers are owned by their users, they're just dropped here.
+void net_wheel_destroy(net_loop_t *loop)
+{
+    net_wheel_t *w = loop->wheel;
+
+    if (w == NULL) return;
+
+    free(w);
+    loop->wheel = NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef _WHEEL_H_
+#define _WHEEL_H_
+
+#include <stdint.h>
+
+#include "net.h"
+
+/*
+ * Per-loop hierarchical timing wheel behind net_timer_t.
+ *
+ * The root wheel has one slot per millisecond for the next 256ms, each
+ * upper level covers 64 slots of the level below, so 4 of them reach
+ * past 49 days. Arming and cancelling a timer is a list insert/delete,
+ * timers move down one level when the slot above comes due. There's no
+ * timer fd: the loop sleeps until the earliest pending expiry (see
+ * net_wheel_timeout()) and runs what's due after each wait.
+ */
+
+#define WHEEL_ROOT_BITS  8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS     4
+
+void net_wheel_add(net_loop_t *, net_timer_t *);
+void net_wheel_del(net_loop_t *, net_timer_t *);
+void net_wheel_destroy(net_loop_t *);
+void net_wheel_expire(net_loop_t *);
+int  net_wheel_timeout(net_loop_t *);
+
+#endif // _WHEEL_H_